@@ -1,20 +1,147 @@
 #include <cmath>
-#include <fstream>
 #include <cstring>
 #include <string>
-#include <sstream>
 #include <algorithm>
-#include <functional>
 #include <iostream>
+#include <limits>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "Graph.h"
+#include "KdTree.h"
+#include "Tsplib.h"
+#include "Stats.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAPH_AVX2 1
+#include <immintrin.h>
+#endif
 
 //    Point
+// The differences are taken in float and squared in double, which is exact
 int euclidian_dist(Point a, Point b) {
-  return std::round(std::sqrt( std::pow(a.x - b.x, 2) + std::pow(a.y - b.y, 2) ));
+  double dx = a.x - b.x, dy = a.y - b.y;
+  return std::round(std::sqrt(dx*dx + dy*dy));
 }
 
 int pseudo_euclidian_dist(Point a, Point b) {
-  return std::ceil(std::sqrt( (std::pow(a.x - b.x, 2) + std::pow(a.y - b.y, 2)) / 10.0 ));
+  double dx = a.x - b.x, dy = a.y - b.y;
+  return std::ceil(std::sqrt((dx*dx + dy*dy) / 10.0));
+}
+
+int ceil_euclidian_dist(Point a, Point b) {
+  double dx = a.x - b.x, dy = a.y - b.y;
+  return std::ceil(std::sqrt(dx*dx + dy*dy));
+}
+
+// TSPLIB GEO: coordinates are DDD.MM latitude and longitude
+static double geo_radians(float coord) {
+  const double PI = 3.141592;
+  int deg = static_cast<int>(coord);
+  double min = coord - deg;
+  return PI * (deg + 5.0 * min / 3.0) / 180.0;
+}
+
+int geo_dist(Point a, Point b) {
+  const double RRR = 6378.388;
+  double q1 = std::cos(geo_radians(a.y) - geo_radians(b.y));
+  double q2 = std::cos(geo_radians(a.x) - geo_radians(b.x));
+  double q3 = std::cos(geo_radians(a.x) + geo_radians(b.x));
+  return static_cast<int>(RRR * std::acos(0.5*((1.0 + q1)*q2 - (1.0 - q1)*q3)) + 1.0);
+}
+
+//    Row kernels
+// Distances from node i to the nodes [from, to) out of SoA coordinates, with the
+// same arithmetic as the metric functions above so the results match bit for bit
+enum RowMetric { ROW_EUCLID, ROW_PSEUDO_EUCLID, ROW_CEIL_EUCLID };
+typedef void (*RowKernel)(const float*, const float*, int, int, int, int*);
+
+template <int METRIC>
+static void dist_row_scalar(const float *xs, const float *ys, int i, int from, int to, int *out) {
+  for (int j=from; j<to; j++) {
+    double dx = xs[i] - xs[j], dy = ys[i] - ys[j];
+    double d2 = dx*dx + dy*dy;
+    if (METRIC == ROW_EUCLID) {
+      out[j] = std::round(std::sqrt(d2));
+    }
+    else if (METRIC == ROW_PSEUDO_EUCLID) {
+      out[j] = std::ceil(std::sqrt(d2 / 10.0));
+    }
+    else {
+      out[j] = std::ceil(std::sqrt(d2));
+    }
+  }
+}
+
+#ifdef GRAPH_AVX2
+// std::round is emulated as floor plus a >= 0.5 test on the exact remainder.
+// No fma on purpose, a fused multiply-add would change the rounding of d2
+template <int METRIC>
+__attribute__((target("avx2")))
+static void dist_row_avx2(const float *xs, const float *ys, int i, int from, int to, int *out) {
+  const __m128 xi = _mm_set1_ps(xs[i]), yi = _mm_set1_ps(ys[i]);
+  const __m256d half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0), ten = _mm256_set1_pd(10.0);
+
+  int j = from;
+  for (; j+4<=to; j+=4) {
+    __m256d dx = _mm256_cvtps_pd(_mm_sub_ps(xi, _mm_loadu_ps(xs + j)));
+    __m256d dy = _mm256_cvtps_pd(_mm_sub_ps(yi, _mm_loadu_ps(ys + j)));
+    __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    __m256d d;
+    if (METRIC == ROW_EUCLID) {
+      __m256d r = _mm256_sqrt_pd(d2);
+      d = _mm256_round_pd(r, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+      __m256d up = _mm256_cmp_pd(_mm256_sub_pd(r, d), half, _CMP_GE_OQ);
+      d = _mm256_add_pd(d, _mm256_and_pd(up, one));
+    }
+    else if (METRIC == ROW_PSEUDO_EUCLID) {
+      d = _mm256_round_pd(_mm256_sqrt_pd(_mm256_div_pd(d2, ten)), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+    }
+    else {
+      d = _mm256_round_pd(_mm256_sqrt_pd(d2), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm256_cvttpd_epi32(d));
+  }
+  dist_row_scalar<METRIC>(xs, ys, i, j, to, out);
+}
+#endif
+
+template <int METRIC>
+static RowKernel select_row_kernel() {
+#ifdef GRAPH_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return dist_row_avx2<METRIC>;
+  }
+#endif
+  return dist_row_scalar<METRIC>;
+}
+
+// nullptr for the metrics without a row kernel (GEO)
+static RowKernel row_kernel(int (*dist_func)(Point, Point)) {
+  if (dist_func == euclidian_dist) return select_row_kernel<ROW_EUCLID>();
+  if (dist_func == pseudo_euclidian_dist) return select_row_kernel<ROW_PSEUDO_EUCLID>();
+  if (dist_func == ceil_euclidian_dist) return select_row_kernel<ROW_CEIL_EUCLID>();
+  return nullptr;
+}
+
+// Runs body(first, step) on the threads, rows are dealt round robin
+template <class Body>
+static void parallel_rows(int n, Body body) {
+  int n_threads = std::max(1u, std::thread::hardware_concurrency());
+  n_threads = std::min(n_threads, n / 512 + 1);
+
+  std::vector<std::thread> threads;
+  for (int t=1; t<n_threads; t++) {
+    threads.emplace_back(body, t, n_threads);
+  }
+  body(0, n_threads);
+  for (std::thread &t : threads) {
+    t.join();
+  }
 }
 
 //    HamiltonianCycle
@@ -37,6 +164,17 @@ void HamiltonianCycle::add(int id, int position) {
   positions[id] = position;
 }
 
+// Whole tour of length len, positions included
+void HamiltonianCycle::assign(const std::vector<int> &nodes, double length) {
+  resize(nodes.size());
+  tour = nodes;
+  for (int i=0; i<size; i++) {
+    positions[tour[i]] = i;
+  }
+  len = length;
+  valid = true;
+}
+
 int HamiltonianCycle::next(int id) {
   int next = (positions[id] + 1) % size;
   return tour[next];
@@ -56,16 +194,39 @@ void HamiltonianCycle::swap(int idx1, int idx2) {
   positions[tour[idx2]] = idx2;
 }
 
+// Reverses the tour from position start to end (wrapping around). On a cycle the
+// complementary path gives the same tour, so the shorter of the two is reversed.
 void HamiltonianCycle::reverse(int start, int end) {
-  int inversion_size = ((size + end - start + 1) % size)/2;
-  int left = start, right = end;
-
-  for (int i=0; i<inversion_size; i++) {
-    swap(left, right);
+  int length = (size + end - start + 1) % size;
+  if (2*length > size) {
+    int aux = (end + 1) % size;
+    end = (start + size - 1) % size;
+    start = aux;
+    length = size - length;
+  }
+  if (length < 2) return;
+  STATS_INC(reversals);
+  STATS_ADD(reversed, length);
+
+  std::vector<int>::iterator first = tour.begin() + start;
+  if (start <= end) {
+    std::reverse(first, tour.begin() + end + 1);
+    for (int i=start; i<=end; i++) positions[tour[i]] = i;
+    return;
+  }
 
-    left = (left + 1) % size;
-    right = (size + right - 1) % size;
+  // Wrapped segment: the outer pairs cross the end of the array, the rest is contiguous
+  int tail = size - start, head = end + 1;
+  int pairs = std::min(tail, head);
+  std::swap_ranges(first, first + pairs, std::vector<int>::reverse_iterator(tour.begin() + head));
+  if (tail > head) {
+    std::reverse(first + pairs, tour.end());
   }
+  else {
+    std::reverse(tour.begin(), tour.begin() + head - pairs);
+  }
+  for (int i=start; i<size; i++) positions[tour[i]] = i;
+  for (int i=0; i<head; i++) positions[tour[i]] = i;
 }
 
 bool HamiltonianCycle::between(int a, int b, int c) {
@@ -77,124 +238,219 @@ bool HamiltonianCycle::between(int a, int b, int c) {
   }
 }
 
+// Replaces edges (a, b) and (d, c) by (a, d) and (b, c), with b = next(a) and c = next(d)
+// or b = prev(a) and c = prev(d)
 void HamiltonianCycle::flip(int a, int b, int c, int d) {
-  std::vector<int> new_cycle;
-  new_cycle.reserve(size);
-
-  new_cycle.push_back(b);
+  if (next(a) == b) {
+    reverse(positions[b], positions[d]);
+  }
+  else {
+    reverse(positions[a], positions[c]);
+  }
+}
 
-  if (between(b, c, d)) {
-    while(prev(b) != d) {
-      b = prev(b);
-      new_cycle.push_back(b);
-    }
+//    DistMatrix
+DistMatrix::DistMatrix(): n(0), upper(false) { }
 
-    new_cycle.push_back(d);
-    new_cycle.push_back(a);
+// Upper triangular storage keeps row i from column i on, so the row offset is
+// skewed by i to index it with the plain column j
+void DistMatrix::resize(int n, long long max_dist, bool upper, bool compact) {
+  clear();
+  this->n = n;
+  this->upper = upper;
 
-    while(next(a) != c) {
-      a = next(a);
-      new_cycle.push_back(a);
+  row.resize(n);
+  long long size = 0;
+  for (int i=0; i<n; i++) {
+    if (upper) {
+      row[i] = size - i;
+      size += n - i;
+    }
+    else {
+      row[i] = size;
+      size += n;
     }
-    new_cycle.push_back(c);
   }
 
+  if (compact && max_dist <= std::numeric_limits<unsigned short>::max()) {
+    narrow.resize(size);
+  }
   else {
-    while(next(b) != d) {
-      b = next(b);
-      new_cycle.push_back(b);
-    }
+    wide.resize(size);
+  }
+}
 
-    new_cycle.push_back(d);
-    new_cycle.push_back(a);
+void DistMatrix::clear() {
+  n = 0;
+  upper = false;
+  std::vector<long long>().swap(row);
+  std::vector<unsigned short>().swap(narrow);
+  std::vector<int>().swap(wide);
+}
 
-    while(prev(a) != c) {
-      a = prev(a);
-      new_cycle.push_back(a);
-    }
-    new_cycle.push_back(c);
+void DistMatrix::set(int i, int j, int d) {
+  long long idx = index(i, j);
+  if (!narrow.empty()) {
+    narrow[idx] = d;
   }
+  else {
+    wide[idx] = d;
+  }
+}
 
-  tour = new_cycle;
-  for (int i=0; i<size; i++) {
-    positions[tour[i]] = i;
+// Entries [from, from + count) of row i, from >= i in triangular storage
+void DistMatrix::set_row(int i, int from, const int *d, int count) {
+  long long idx = row[i] + from;
+  if (!narrow.empty()) {
+    for (int j=0; j<count; j++) {
+      narrow[idx + j] = d[j];
+    }
+  }
+  else {
+    std::copy(d, d + count, wide.begin() + idx);
   }
 }
 
-//  Graph
-Graph::Graph(): n(0), built(false) { }
+bool DistMatrix::compact() const {
+  return !narrow.empty();
+}
 
-Graph::~Graph() {
-  for (int i=0; i<n; i++) {
-    delete[] dist_matrix[i];
-  }
-  delete[] dist_matrix;
+bool DistMatrix::triangular() const {
+  return upper;
 }
 
-void Graph::build(const char* f_name, const char* metric, bool neighbor_list) {
-  std::ifstream file(f_name);
+long long DistMatrix::bytes() const {
+  return narrow.size() * sizeof(unsigned short) + wide.size() * sizeof(int);
+}
 
-  // Test if file exists
-  if (!file.is_open()) {
-    std::cout << "Graph - build:" << std::endl;
-    std::cout << "Could not open the file" << std::endl;
-    std::exit(EXIT_FAILURE);
-  }
+//    NeighborList
+NeighborList::NeighborList(): n(0), k(0), rows(nullptr) { }
 
-  // Cleaning
+void NeighborList::resize(int n, int k) {
+  this->n = n;
+  this->k = k;
+  data.assign(static_cast<long long>(n) * k, 0);
+  rows = data.data();
+}
+
+// n rows of k entries stored at rows, which must outlive the list
+void NeighborList::attach(int n, int k, int *rows) {
+  this->n = n;
+  this->k = k;
+  std::vector<int>().swap(data);
+  this->rows = rows;
+}
+
+void NeighborList::clear() {
+  n = 0;
+  k = 0;
+  std::vector<int>().swap(data);
+  rows = nullptr;
+}
+
+//  Graph
+Graph::Graph(): n(0), sparse(false), dist_func(nullptr), cache_size(0), mapped(nullptr), mapped_size(0) { }
+
+Graph::~Graph() {
+  clear();
+}
+
+void Graph::clear() {
   cycle.clear();
   sorted_neighbor.clear();
-  if (built) {
-    for (int i=0; i<n; i++) {
-      delete[] dist_matrix[i];
-    }
-    delete[] dist_matrix;
+  dist_matrix.clear();
+  kdtree.reset();
+  cache.reset();
+  cache_size = 0;
+  sparse = false;
+  if (mapped != nullptr) {
+    munmap(mapped, mapped_size);
+    mapped = nullptr;
+    mapped_size = 0;
   }
-  built = true;
+}
 
-  // Reading the header and number of vertices
-  std::string aux;
+// neighbors is the size of the candidate lists (0 for none), upper stores only the
+// upper triangle of the matrix, compact allows uint16 entries
+void Graph::build(const char* f_name, const char* metric, int neighbors, bool upper, bool compact) {
+  TsplibInstance inst;
+  read_tsplib(f_name, inst);
+  build(inst, metric, neighbors, upper, compact);
+}
 
-  for (int i=0; i<4; i++) std::getline(file, aux); // Reding first 4 header lines
-  std::stringstream ss(aux.substr(11));
-  ss >> n;                                          // getting the number of vertices
-  for (int i=0; i<2; i++) std::getline(file, aux); // Reading last 2 header lines
+// From an instance already read, its coordinates are moved into the graph
+void Graph::build(TsplibInstance &inst, const char* metric, int neighbors, bool upper, bool compact) {
+  // Cleaning
+  clear();
 
-  // Reading Coordinates
-  int id;
-  std::vector<Point> coords(n);
+  n = inst.dimension;
+  coords.swap(inst.coords);
+  set_metric(metric, inst);
 
-  for (int i=0; i<n; i++) {
-    file >> id >> coords[i].x >> coords[i].y;
+  // Building distance matrix
+  dist_matrix.resize(n, max_dist(inst), upper, compact);
+  build_dist_matrix(inst);
+
+  // Build sorted neighbor list
+  if (neighbors > 0) {
+    build_neighbor_list(neighbors);
   }
-  file.close();
 
-  // Building distance matrix
-  dist_matrix = new double*[n];
-  for (int i=0; i<n; i++) {
-    dist_matrix[i] = new double[n];
+  if (!coords.empty()) {
+    kdtree.reset(new KdTree());
+    kdtree->build(coords);
   }
 
-  build_dist_matrix(metric, coords);
+  // initialize cycle
+  cycle.resize(n);
+  cycle.len = 0;
+  cycle.valid = false;
+}
 
-  // Build sorted neighbor list
-  if (neighbor_list) {
-    sorted_neighbor.resize(n);
-    for (int i=0; i<n; i++) {
-      sorted_neighbor[i].resize(n);
-    }
+void Graph::build_sparse(const char* f_name, int k, const char* metric, int cache) {
+  TsplibInstance inst;
+  read_tsplib(f_name, inst);
+  build_sparse(inst, k, metric, cache);
+}
+
+void Graph::build_sparse(TsplibInstance &inst, int k, const char* metric, int cache) {
+  // Cleaning
+  clear();
+  sparse = true;
+
+  n = inst.dimension;
+  coords.swap(inst.coords);
+  set_metric(metric, inst);
+  if (dist_func == nullptr) {
+    std::cout << "Graph - build_sparse:" << std::endl;
+    std::cout << "Sparse mode requires node coordinates" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (k < 1) {
+    std::cout << "Graph - build_sparse:" << std::endl;
+    std::cout << "Sparse mode requires at least one neighbor per node" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
 
-    build_neighbor_list();
+  // Optional distance cache, cache_size entries per node (power of 2)
+  if (cache > 0) {
+    for (cache_size = 1; cache_size < cache; cache_size *= 2);
+    this->cache.reset(new std::atomic<unsigned long long>[static_cast<long long>(n) * cache_size]());
   }
 
+  build_candidate_list(std::min(k, n-1));
+
   // initialize cycle
   cycle.resize(n);
   cycle.len = 0;
   cycle.valid = false;
 }
 
-void Graph::build_dist_matrix(const char* metric, std::vector<Point> &coords) {
-  std::function<int(Point, Point)> dist_func;
+// "auto" takes the metric from the EDGE_WEIGHT_TYPE of the file
+void Graph::set_metric(const char* metric, const TsplibInstance &inst) {
+  if (std::strcmp(metric, "auto") == 0) {
+    metric = tsplib_metric(inst);
+  }
 
   if (std::strcmp(metric, "euclid") == 0) {
     dist_func = euclidian_dist;
@@ -202,29 +458,357 @@ void Graph::build_dist_matrix(const char* metric, std::vector<Point> &coords) {
   else if (std::strcmp(metric, "pseudo_euclid") == 0) {
     dist_func = pseudo_euclidian_dist;
   }
+  else if (std::strcmp(metric, "ceil_euclid") == 0) {
+    dist_func = ceil_euclidian_dist;
+  }
+  else if (std::strcmp(metric, "geo") == 0) {
+    dist_func = geo_dist;
+  }
+  else if (std::strcmp(metric, "explicit") == 0 && !inst.weights.empty()) {
+    dist_func = nullptr;
+  }
   else {
     std::cout << "Invalid distance metric: " << metric << std::endl;
     std::exit(EXIT_FAILURE);
   }
 
+  if (dist_func != nullptr && coords.empty()) {
+    std::cout << "Graph - set_metric:" << std::endl;
+    std::cout << "Metric " << metric << " requires node coordinates" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// Upper bound of the distances, picks the element type of the matrix before filling it.
+// The coordinate metrics grow with |dx| and |dy|, so the bounding box diagonal bounds them
+long long Graph::max_dist(const TsplibInstance &inst) const {
+  if (dist_func == nullptr) {
+    long long max = 0;
+    for (size_t i=0; i<inst.weights.size(); i++) {
+      if (inst.weights[i] < 0) {
+        return std::numeric_limits<long long>::max();
+      }
+      max = std::max(max, static_cast<long long>(inst.weights[i]));
+    }
+    return max;
+  }
+  if (dist_func == geo_dist) {
+    return 20040; // Half of the TSPLIB earth circumference
+  }
+
+  Point lo = coords[0], hi = coords[0];
+  for (int i=1; i<n; i++) {
+    lo.x = std::min(lo.x, coords[i].x);
+    lo.y = std::min(lo.y, coords[i].y);
+    hi.x = std::max(hi.x, coords[i].x);
+    hi.y = std::max(hi.y, coords[i].y);
+  }
+  return dist_func(lo, hi);
+}
+
+void Graph::build_dist_matrix(const TsplibInstance &inst) {
+  bool upper = dist_matrix.triangular();
+
+  if (dist_func == nullptr) {
+    for (int i=0; i<n; i++) {
+      for (int j=(upper ? i : 0); j<n; j++) {
+        dist_matrix.set(i, j, inst.weights[static_cast<long long>(i)*n + j]);
+      }
+    }
+    return;
+  }
+
+  // Round robin rows keep the triangular layout balanced
+  std::vector<float> xs(n), ys(n);
   for (int i=0; i<n; i++) {
+    xs[i] = coords[i].x;
+    ys[i] = coords[i].y;
+  }
+
+  parallel_rows(n, [&](int first, int step) {build_dist_rows(xs.data(), ys.data(), first, step);});
+}
+
+// Full rows are computed even in the square layout, each thread writes only its own rows
+void Graph::build_dist_rows(const float *xs, const float *ys, int first, int step) {
+  RowKernel kernel = row_kernel(dist_func);
+  bool upper = dist_matrix.triangular();
+  std::vector<int> row(n);
+
+  for (int i=first; i<n; i+=step) {
+    int from = upper ? i : 0;
+    if (kernel != nullptr) {
+      kernel(xs, ys, i, from, n, row.data());
+    }
+    else {
+      for (int j=from; j<n; j++) {
+        row[j] = dist_func(coords[i], coords[j]);
+      }
+    }
+    dist_matrix.set_row(i, from, row.data() + from, n - from);
+  }
+}
+
+// k nearest nodes of each node from the distance matrix. With quadrant, k / 4 of them
+// are the nearest in each quadrant around the node and the rest the nearest overall,
+// which keeps candidates across the gaps of clustered instances
+void Graph::build_neighbor_list(int k, bool quadrant) {
+  if (sparse) {
+    std::cout << "Graph - build_neighbor_list:" << std::endl;
+    std::cout << "Sparse mode keeps the candidate list of build_sparse" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  k = std::min(k, n-1);
+  quadrant = quadrant && !coords.empty();
+
+  sorted_neighbor.resize(n, k+1);
+  parallel_rows(n, [&](int first, int step) {build_neighbor_rows(k, quadrant, first, step);});
+}
+
+// Candidates are (distance, node) pairs, so ties are broken by node index
+void Graph::build_neighbor_rows(int k, bool quadrant, int first, int step) {
+  std::vector<std::pair<int, int> > cand, quad[4];
+  std::vector<std::pair<int, int> > chosen;
+  std::vector<char> picked(n, false);
+
+  for (int i=first; i<n; i+=step) {
+    cand.clear();
     for (int j=0; j<n; j++) {
-      if (i <= j) {
-        dist_matrix[i][j] = dist_func(coords[i], coords[j]);
+      if (j != i) cand.push_back({dist_matrix(i, j), j});
+    }
+    std::nth_element(cand.begin(), cand.begin() + k, cand.end());
+    cand.resize(k);
+    std::sort(cand.begin(), cand.end());
+
+    chosen.clear();
+    if (quadrant) {
+      for (int q=0; q<4; q++) quad[q].clear();
+      for (int j=0; j<n; j++) {
+        if (j == i) continue;
+        int q = (coords[j].x >= coords[i].x ? 0 : 1) + (coords[j].y >= coords[i].y ? 0 : 2);
+        quad[q].push_back({dist_matrix(i, j), j});
       }
-      else {
-        dist_matrix[i][j] = dist_matrix[j][i];
+      for (int q=0; q<4; q++) {
+        int m = std::min(k / 4, static_cast<int>(quad[q].size()));
+        std::nth_element(quad[q].begin(), quad[q].begin() + m, quad[q].end());
+        for (int idx=0; idx<m; idx++) {
+          chosen.push_back(quad[q][idx]);
+          picked[quad[q][idx].second] = true;
+        }
       }
     }
+    for (int idx=0; idx<k && static_cast<int>(chosen.size())<k; idx++) {
+      if (!picked[cand[idx].second]) chosen.push_back(cand[idx]);
+    }
+    std::sort(chosen.begin(), chosen.end());
+
+    int *row = sorted_neighbor[i];
+    row[0] = i;
+    for (int idx=0; idx<k; idx++) {
+      row[idx+1] = chosen[idx].second;
+      picked[chosen[idx].second] = false;
+    }
   }
 }
 
-void Graph::build_neighbor_list() {
+// k nearest nodes of each node, the node itself in first position as in the dense list.
+// The k-d tree is planar, so the rows are sorted again by the metric (GEO distances do
+// not follow the planar order, and the local searches stop at the first candidate too far)
+void Graph::build_candidate_list(int k) {
+  std::vector<std::pair<double, int> > nearest;
+  std::vector<std::pair<int, int> > cand(k);
+
+  kdtree.reset(new KdTree());
+  kdtree->build(coords);
+
+  sorted_neighbor.resize(n, k+1);
   for (int i=0; i<n; i++) {
-    for (int j=0; j<n; j++) {
-      sorted_neighbor[i][j] = j;
+    kdtree->nearest_k(i, k, nearest);
+    for (int j=0; j<k; j++) {
+      cand[j] = {dist_func(coords[i], coords[nearest[j].second]), nearest[j].second};
     }
-    std::sort(sorted_neighbor[i].begin(), sorted_neighbor[i].end(),
-      [&](int a, int b) {return dist_matrix[i][a] < dist_matrix[i][b];});
+    std::sort(cand.begin(), cand.end());
+
+    int *row = sorted_neighbor[i];
+    row[0] = i;
+    for (int j=0; j<k; j++) {
+      row[j+1] = cand[j].second;
+    }
+  }
+}
+
+// On demand distance of the sparse mode. Cache entries pack (j + 1) and the distance
+// in one word so concurrent readers never see a torn entry.
+int Graph::sparse_dist(int i, int j) const {
+  if (cache_size == 0) {
+    return dist_func(coords[i], coords[j]);
+  }
+  if (i > j) std::swap(i, j);
+
+  std::atomic<unsigned long long> &entry = cache[static_cast<long long>(i) * cache_size + (j & (cache_size - 1))];
+  unsigned long long value = entry.load(std::memory_order_relaxed);
+  if ((value >> 32) == static_cast<unsigned long long>(j) + 1) {
+    return static_cast<unsigned>(value);
+  }
+
+  int d = dist_func(coords[i], coords[j]);
+  entry.store(((static_cast<unsigned long long>(j) + 1) << 32) | static_cast<unsigned>(d), std::memory_order_relaxed);
+  return d;
+}
+
+//    Binary cache
+// Coordinate instances only. Layout, native byte order: CacheHeader, the n coordinates,
+// then the n x width neighbor table. A cache written for another version, source file,
+// requested metric or number of neighbors is stale and gets rebuilt.
+const char CACHE_MAGIC[8] = {'T', 'S', 'P', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t CACHE_VERSION = 3;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t n;
+  uint64_t checksum;     // FNV-1a of the source file
+  char metric[16];       // resolved by the build
+  char requested[16];    // as requested, "auto" only matches "auto"
+  int32_t neighbors;     // as requested by the build
+  int32_t width;         // of the neighbor rows, 0 for none
+};
+
+// 0 when the file can not be read, the build then reports it
+static unsigned long long file_checksum(const char *f_name) {
+  int fd = open(f_name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+
+  unsigned long long hash = 14695981039346656037ULL;
+  size_t size = st.st_size;
+  void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+  if (data != MAP_FAILED && data != nullptr) {
+    madvise(data, size, MADV_SEQUENTIAL);
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    for (size_t i=0; i<size; i++) {
+      hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    munmap(data, size);
+  }
+  close(fd);
+  return hash;
+}
+
+static const char* metric_name(int (*dist_func)(Point, Point)) {
+  if (dist_func == euclidian_dist) return "euclid";
+  if (dist_func == pseudo_euclidian_dist) return "pseudo_euclid";
+  if (dist_func == ceil_euclidian_dist) return "ceil_euclid";
+  if (dist_func == geo_dist) return "geo";
+  return "explicit";
+}
+
+// Builds as build (neighbors > 0) or build_sparse, through the binary cache file
+// cache_name: the coordinates are copied out of it and the neighbor table is mapped
+// in place. The cache is (re)written after a build when it is missing or stale.
+void Graph::build_cached(const char* f_name, const char* cache_name, int neighbors, bool sparse, const char* metric) {
+  unsigned long long checksum = file_checksum(f_name);
+
+  if (checksum != 0 && load_cached(cache_name, checksum, neighbors, sparse, metric)) {
+    return;
+  }
+
+  if (sparse) {
+    build_sparse(f_name, neighbors, metric);
+  }
+  else {
+    build(f_name, metric, neighbors);
+  }
+  if (dist_func != nullptr) {
+    save_cached(cache_name, checksum, neighbors, metric);
+  }
+}
+
+bool Graph::load_cached(const char* cache_name, unsigned long long checksum, int neighbors, bool sparse, const char* metric) {
+  int fd = open(cache_name, O_RDONLY);
+  struct stat st;
+  if (fd < 0) return false;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  // Private writable mapping, so writes through sorted_neighbor never reach the file
+  size_t size = st.st_size;
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  CacheHeader header;
+  std::memcpy(&header, data, sizeof(CacheHeader));
+  bool valid = std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+    && header.version == CACHE_VERSION && header.checksum == checksum && header.n > 0
+    && header.neighbors == neighbors && header.metric[sizeof(header.metric) - 1] == '\0'
+    && header.requested[sizeof(header.requested) - 1] == '\0' && std::strcmp(metric, header.requested) == 0
+    && size == sizeof(CacheHeader) + header.n * sizeof(Point) + static_cast<size_t>(header.n) * header.width * sizeof(int);
+  if (!valid) {
+    munmap(data, size);
+    return false;
+  }
+
+  // Cleaning
+  clear();
+  this->sparse = sparse;
+  mapped = data;
+  mapped_size = size;
+
+  char *p = static_cast<char*>(data) + sizeof(CacheHeader);
+  n = header.n;
+  coords.assign(reinterpret_cast<Point*>(p), reinterpret_cast<Point*>(p) + n);
+  set_metric(header.metric, TsplibInstance());
+  if (header.width > 0) {
+    sorted_neighbor.attach(n, header.width, reinterpret_cast<int*>(p + n * sizeof(Point)));
+  }
+
+  kdtree.reset(new KdTree());
+  kdtree->build(coords);
+  if (!sparse) {
+    TsplibInstance inst;
+    dist_matrix.resize(n, max_dist(inst));
+    build_dist_matrix(inst);
+  }
+
+  // initialize cycle
+  cycle.resize(n);
+  cycle.len = 0;
+  cycle.valid = false;
+  return true;
+}
+
+// Written to a temporary file and renamed, readers never see a partial cache
+void Graph::save_cached(const char* cache_name, unsigned long long checksum, int neighbors, const char* metric) const {
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(CacheHeader));
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = CACHE_VERSION;
+  header.n = n;
+  header.checksum = checksum;
+  std::strncpy(header.metric, metric_name(dist_func), sizeof(header.metric) - 1);
+  std::strncpy(header.requested, metric, sizeof(header.requested) - 1);
+  header.neighbors = neighbors;
+  header.width = sorted_neighbor.width();
+
+  std::string tmp_name = std::string(cache_name) + ".tmp";
+  FILE *f = std::fopen(tmp_name.c_str(), "wb");
+  bool written = f != nullptr
+    && std::fwrite(&header, sizeof(CacheHeader), 1, f) == 1
+    && std::fwrite(coords.data(), sizeof(Point), n, f) == static_cast<size_t>(n)
+    && (header.width == 0 || std::fwrite(sorted_neighbor[0], sizeof(int), static_cast<size_t>(n) * header.width, f)
+                             == static_cast<size_t>(n) * header.width);
+  if (f != nullptr) {
+    written = (std::fclose(f) == 0) && written;
+  }
+
+  if (!written || std::rename(tmp_name.c_str(), cache_name) != 0) {
+    std::remove(tmp_name.c_str());
+    std::cout << "Graph - build_cached:" << std::endl;
+    std::cout << "Could not write the cache file " << cache_name << std::endl;
   }
 }
@@ -2,6 +2,9 @@
 #define GRAPH_H
 
 #include <vector>
+#include <atomic>
+#include <memory>
+#include <utility>
 
 // -----------------> Structs
 struct Point {
@@ -9,6 +12,8 @@ struct Point {
 };
 int euclidian_dist(Point, Point);
 int pseudo_euclidian_dist(Point, Point);
+int ceil_euclidian_dist(Point, Point);
+int geo_dist(Point, Point);
 
 //------------------> Class HamiltonianCycle
 class HamiltonianCycle {
@@ -22,6 +27,7 @@ public:
   void resize(int);
   void clear();
   void add(int, int);
+  void assign(const std::vector<int>&, double);
   void swap(int, int);
   void reverse(int, int);
   int next(int);
@@ -35,22 +41,124 @@ private:
   int size;
 };
 
+//------------------> Class DistMatrix
+// Flat integer distance store. Entries are kept as uint16 when the largest
+// distance fits, int32 otherwise, and optionally only the upper triangle.
+class DistMatrix {
+public:
+  DistMatrix();
+  void resize(int, long long, bool = false, bool = true);
+  void clear();
+  void set(int, int, int);
+  void set_row(int, int, const int*, int);
+  int operator()(int, int) const;
+  bool compact() const;
+  bool triangular() const;
+  long long bytes() const;
+
+private:
+  int n;
+  bool upper;
+  std::vector<long long> row;          // Offset of row i, minus the column skew
+  std::vector<unsigned short> narrow;  // uint16 storage
+  std::vector<int> wide;               // int32 storage
+
+  long long index(int, int) const;
+};
+
+inline long long DistMatrix::index(int i, int j) const {
+  if (upper && i > j) std::swap(i, j);
+  return row[i] + j;
+}
+
+inline int DistMatrix::operator()(int i, int j) const {
+  long long idx = index(i, j);
+  if (!narrow.empty()) {
+    return narrow[idx];
+  }
+  return wide[idx];
+}
+
+//------------------> Class NeighborList
+// K candidate neighbors of each node in one flat n x (K + 1) array, the node
+// itself first and the others sorted by distance
+class NeighborList {
+public:
+  NeighborList();
+  void resize(int, int);
+  void attach(int, int, int*);
+  void clear();
+  int width() const;
+  int* operator[](int);
+  const int* operator[](int) const;
+
+private:
+  int n;
+  int k;
+  int *rows;               // data, or rows owned by someone else (attach)
+  std::vector<int> data;
+};
+
+inline int NeighborList::width() const {
+  return k;
+}
+
+inline int* NeighborList::operator[](int i) {
+  return rows + static_cast<long long>(i) * k;
+}
+
+inline const int* NeighborList::operator[](int i) const {
+  return rows + static_cast<long long>(i) * k;
+}
+
 // -----------------> Graph Class
+class KdTree;
+struct TsplibInstance;
+
 class Graph {
 public:
   int n;                                          // Number of vertices
-  double **dist_matrix;                           // Adjacency matrix
-  std::vector<std::vector<int> > sorted_neighbor; // Sorted list of Neighbor for each node
+  DistMatrix dist_matrix;                         // Adjacency matrix (empty in sparse mode)
+  NeighborList sorted_neighbor;                   // Sorted list of Neighbor for each node
   HamiltonianCycle cycle;                         // Current solution of the TSP
+  std::vector<Point> coords;                      // Coordinates of the vertices
+  bool sparse;                                    // Only k nearest neighbors, distances on demand
+  std::unique_ptr<KdTree> kdtree;                 // Spatial index of coords (none without them)
 
   Graph();
   ~Graph();
-  void build(const char*, const char* = "euclid", bool = false);
+  void build(const char*, const char* = "auto", int = 0, bool = false, bool = true);
+  void build(TsplibInstance&, const char* = "auto", int = 0, bool = false, bool = true);
+  void build_sparse(const char*, int, const char* = "auto", int = 0);
+  void build_sparse(TsplibInstance&, int, const char* = "auto", int = 0);
+  void build_cached(const char*, const char*, int, bool = false, const char* = "auto");
+  void build_neighbor_list(int, bool = false);
+  int dist(int, int) const;
 
 private:
-  bool built;
-  void build_dist_matrix(const char*, std::vector<Point>&);
-  void build_neighbor_list();
+  int (*dist_func)(Point, Point);
+  int cache_size;
+  std::unique_ptr<std::atomic<unsigned long long>[]> cache;
+  void *mapped;                                   // Binary cache file backing sorted_neighbor
+  size_t mapped_size;
+
+  void clear();
+  void set_metric(const char*, const TsplibInstance&);
+  long long max_dist(const TsplibInstance&) const;
+  void build_dist_matrix(const TsplibInstance&);
+  void build_dist_rows(const float*, const float*, int, int);
+  void build_neighbor_rows(int, bool, int, int);
+  void build_candidate_list(int);
+  int sparse_dist(int, int) const;
+  bool load_cached(const char*, unsigned long long, int, bool, const char*);
+  void save_cached(const char*, unsigned long long, int, const char*) const;
 };
 
+inline int Graph::dist(int i, int j) const {
+  if (!sparse) {
+    return dist_matrix(i, j);
+  }
+  return sparse_dist(i, j);
+}
+
 #endif
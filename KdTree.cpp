@@ -0,0 +1,138 @@
+#include <algorithm>
+#include "KdTree.h"
+
+const int BUCKET_SIZE = 8;
+
+KdTree::KdTree() { }
+
+void KdTree::build(const std::vector<Point> &coords) {
+  int n = coords.size();
+
+  nodes.clear();
+  nodes.reserve(2 * (n / BUCKET_SIZE + 1));
+  perm.resize(n);
+  pts = coords;
+  leaf.resize(n);
+  alive.assign(n, true);
+
+  for (int i=0; i<n; i++) {
+    perm[i] = i;
+  }
+  if (n > 0) {
+    build(0, n, -1);
+  }
+}
+
+int KdTree::build(int lo, int hi, int parent) {
+  int id = nodes.size();
+  nodes.emplace_back();
+  KdNode node;
+
+  node.lo = lo;
+  node.hi = hi;
+  node.left = node.right = -1;
+  node.parent = parent;
+  node.count = hi - lo;
+  node.min_x = node.max_x = pts[perm[lo]].x;
+  node.min_y = node.max_y = pts[perm[lo]].y;
+  for (int i=lo+1; i<hi; i++) {
+    node.min_x = std::min(node.min_x, pts[perm[i]].x);
+    node.max_x = std::max(node.max_x, pts[perm[i]].x);
+    node.min_y = std::min(node.min_y, pts[perm[i]].y);
+    node.max_y = std::max(node.max_y, pts[perm[i]].y);
+  }
+
+  if (hi - lo <= BUCKET_SIZE) {
+    for (int i=lo; i<hi; i++) {
+      leaf[perm[i]] = id;
+    }
+  }
+  else {
+    // Splitting the widest dimension at the median
+    int mid = (lo + hi) / 2;
+    if (node.max_x - node.min_x >= node.max_y - node.min_y) {
+      std::nth_element(perm.begin() + lo, perm.begin() + mid, perm.begin() + hi,
+        [&](int a, int b) {return pts[a].x < pts[b].x;});
+    }
+    else {
+      std::nth_element(perm.begin() + lo, perm.begin() + mid, perm.begin() + hi,
+        [&](int a, int b) {return pts[a].y < pts[b].y;});
+    }
+    node.left = build(lo, mid, id);
+    node.right = build(mid, hi, id);
+  }
+
+  nodes[id] = node;
+  return id;
+}
+
+void KdTree::remove(int id) {
+  if (!alive[id]) return;
+  alive[id] = false;
+  for (int node=leaf[id]; node!=-1; node=nodes[node].parent) {
+    nodes[node].count--;
+  }
+}
+
+void KdTree::reset() {
+  std::fill(alive.begin(), alive.end(), true);
+  for (KdNode &node : nodes) {
+    node.count = node.hi - node.lo;
+  }
+}
+
+// Squared distance from a point to the bounding box of a node
+double KdTree::box_dist(int node_id, Point p) const {
+  const KdNode &node = nodes[node_id];
+  double dx = std::max(0.0f, std::max(node.min_x - p.x, p.x - node.max_x));
+  double dy = std::max(0.0f, std::max(node.min_y - p.y, p.y - node.max_y));
+  return dx*dx + dy*dy;
+}
+
+// k nearest points of point id that were not removed, as (squared distance, id) sorted by distance
+void KdTree::nearest_k(int id, int k, std::vector<std::pair<double, int> > &result) const {
+  result.clear();
+  if (k <= 0 || nodes.empty()) return;
+
+  search(0, id, k, result);
+  std::sort_heap(result.begin(), result.end());
+}
+
+void KdTree::search(int node_id, int id, int k, std::vector<std::pair<double, int> > &heap) const {
+  const KdNode &node = nodes[node_id];
+  Point p = pts[id];
+
+  if (node.count == 0) return;
+  if (static_cast<int>(heap.size()) == k && box_dist(node_id, p) >= heap.front().first) return;
+
+  if (node.left == -1) {
+    for (int i=node.lo; i<node.hi; i++) {
+      int j = perm[i];
+      if (!alive[j] || j == id) continue;
+
+      double dx = pts[j].x - p.x, dy = pts[j].y - p.y;
+      std::pair<double, int> entry(dx*dx + dy*dy, j);
+
+      if (static_cast<int>(heap.size()) < k) {
+        heap.push_back(entry);
+        std::push_heap(heap.begin(), heap.end());
+      }
+      else if (entry < heap.front()) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = entry;
+        std::push_heap(heap.begin(), heap.end());
+      }
+    }
+    return;
+  }
+
+  // Nearest child first
+  if (box_dist(node.left, p) <= box_dist(node.right, p)) {
+    search(node.left, id, k, heap);
+    search(node.right, id, k, heap);
+  }
+  else {
+    search(node.right, id, k, heap);
+    search(node.left, id, k, heap);
+  }
+}
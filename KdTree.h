@@ -0,0 +1,39 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <vector>
+#include <utility>
+#include "Graph.h"
+
+//------------------> Class KdTree
+// 2D k-d tree over the coordinates of a graph. Points can be removed (and
+// restored with reset) so it also answers nearest unvisited queries.
+class KdTree {
+public:
+  KdTree();
+  void build(const std::vector<Point>&);
+  void nearest_k(int, int, std::vector<std::pair<double, int> >&) const;
+  void remove(int);
+  void reset();
+
+private:
+  struct KdNode {
+    int lo, hi;            // range in perm
+    int left, right;       // children (-1 on leaves)
+    int parent;
+    int count;             // points not removed
+    float min_x, max_x, min_y, max_y;
+  };
+
+  std::vector<KdNode> nodes;
+  std::vector<int> perm;   // point ids, each node owns a range
+  std::vector<Point> pts;
+  std::vector<int> leaf;   // leaf of each point
+  std::vector<bool> alive;
+
+  int build(int, int, int);
+  double box_dist(int, Point) const;
+  void search(int, int, int, std::vector<std::pair<double, int> >&) const;
+};
+
+#endif
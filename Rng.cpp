@@ -0,0 +1,32 @@
+#include "Rng.h"
+
+//    Rng
+Rng::Rng(uint64_t value) {
+  seed(value);
+}
+
+void Rng::seed(uint64_t value) {
+  // splitmix64
+  for (int i=0; i<4; i++) {
+    uint64_t z = (value += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    s[i] = z ^ (z >> 31);
+  }
+}
+
+void Rng::jump() {
+  static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                  0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+  uint64_t t[4] = {0, 0, 0, 0};
+
+  for (uint64_t word : JUMP) {
+    for (int b=0; b<64; b++) {
+      if (word & (1ULL << b)) {
+        for (int i=0; i<4; i++) t[i] ^= s[i];
+      }
+      (*this)();
+    }
+  }
+  for (int i=0; i<4; i++) s[i] = t[i];
+}
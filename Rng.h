@@ -0,0 +1,57 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+//------------------> Class Rng
+// xoshiro256** generator. The state is seeded with splitmix64 and jump()
+// advances it by 2^128 draws, which gives independent streams for threads.
+// Meets UniformRandomBitGenerator so the std distributions accept it.
+class Rng {
+public:
+  typedef uint64_t result_type;
+
+  explicit Rng(uint64_t = 0);
+  void seed(uint64_t);
+  void jump();
+
+  uint64_t operator()();
+  int uniform(int);        // [0, n)
+  int uniform(int, int);   // [lo, hi]
+  double real();           // [0, 1)
+
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return UINT64_MAX; }
+
+private:
+  uint64_t s[4];
+};
+
+inline uint64_t Rng::operator()() {
+  uint64_t x = s[1] * 5;
+  uint64_t result = ((x << 7) | (x >> 57)) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 45) | (s[3] >> 19);
+  return result;
+}
+
+// Multiply-shift of the high 32 bits, n must be positive
+inline int Rng::uniform(int n) {
+  return static_cast<int>(((*this)() >> 32) * static_cast<uint64_t>(n) >> 32);
+}
+
+inline int Rng::uniform(int lo, int hi) {
+  return lo + uniform(hi - lo + 1);
+}
+
+inline double Rng::real() {
+  return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif
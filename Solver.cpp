@@ -1,4 +1,6 @@
 #include "Solver.h"
+#include "KdTree.h"
+#include "Stats.h"
 #include <array>
 #include <vector>
 #include <iostream>
@@ -6,161 +8,575 @@
 #include <math.h>
 #include <random>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <queue>
+#include <deque>
+#include <functional>
+#include <limits>
+
+#ifdef TSP_DEBUG
+#define CHECK_TOUR(g, cycle, where) check_tour(g, cycle, where)
+#else
+#define CHECK_TOUR(g, cycle, where)
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SOLVER_AVX2 1
+#include <immintrin.h>
+#endif
 
 //    Global constants and typedefs
 typedef std::array<int, 2> Tuple;
+const int LK_DEPTH = 10;     // default max depth of a Lin-Kernighan move inside the metaheuristics
+const int LK_BREADTH = 5;    // default alternatives tried at the first two levels
+const int ILS_SEGMENT = 50;  // max length of the segments moved by a double bridge kick
+const int DEADLINE_CHECK = 64;  // nodes popped by local_search between two deadline checks
+const unsigned HILBERT_SIDE = 1u << 16;  // cells per side of the space filling curve grid
 
-//    Edge
-bool compare_edges(Edge a, Edge b) {
-  return (a.w < b.w);
+//    DisjointSet
+DisjointSet::DisjointSet(int size): parent(size), rank(size, 0) {
+  for (int i=0; i<size; i++) {
+    parent[i] = i;
+  }
 }
 
-//    DisjointSet
-Node* find(Node *node) {
-  if (node->parent != nullptr) {
-    node->parent = find(node->parent);
-    return node->parent;
+// Iterative, with path halving
+int DisjointSet::find(int x) {
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
   }
-  return node;
+  return x;
 }
 
-void merge(Node *n1, Node *n2) {
-  Node *head1 = find(n1);
-  Node *head2 = find(n2);
+// Union by rank, false if x and y were already in the same set
+bool DisjointSet::merge(int x, int y) {
+  x = find(x);
+  y = find(y);
+  if (x == y) return false;
 
-  if (head1->rank > head2->rank) {
-    head2->parent = head1;
+  if (rank[x] > rank[y]) {
+    std::swap(x, y);
   }
-  else if (head1->rank < head2->rank) {
-    head1->parent = head2;
+  parent[x] = y;
+  if (rank[x] == rank[y]) {
+    rank[y]++;
   }
-  else {
-    head1->parent = head2;
-    head2->rank++;
+  return true;
+}
+
+//    TabuList
+TabuList::TabuList(int size): list(size), itr(0), tabu_time(0) { }
+
+bool TabuList::is_tabu(int u, int v) {
+  for (std::pair<int, int> &entry : list[u]) {
+    if (entry.first == v && entry.second > itr) return true;
   }
+  return false;
 }
 
-DisjointSet::DisjointSet(int size) {
-  nodes.resize(size);
-  for (int i=0; i<size; i++) {
-    nodes[i].id = i;
-    nodes[i].parent = nullptr;
-    nodes[i].rank = 0;
+// Edge (u, v) stays tabu for tabu_time iterations
+void TabuList::add(int u, int v) {
+  for (int node : {u, v}) {
+    std::vector<std::pair<int, int> > &entries = list[node];
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+      [&](std::pair<int, int> &entry) {return entry.second <= itr;}), entries.end());
   }
+  list[u].push_back(std::make_pair(v, itr + tabu_time));
+  list[v].push_back(std::make_pair(u, itr + tabu_time));
+  itr++;
 }
 
-//    TabuList
-TabuList::TabuList(int size): size(size) {
-  list = new int* [size];
-  for (int i=0; i<size; i++) {
-    list[i] = new int [size];
-    for (int j=0; j<size; j++) {
-      list[i][j] = 0;
+//    LKStats
+void LKStats::merge(const LKStats &other) {
+  tried.resize(std::max(tried.size(), other.tried.size()), 0);
+  closed.resize(std::max(closed.size(), other.closed.size()), 0);
+  for (size_t d=0; d<other.tried.size(); d++) tried[d] += other.tried[d];
+  for (size_t d=0; d<other.closed.size(); d++) closed[d] += other.closed[d];
+}
+
+void LKStats::clear() {
+  std::fill(tried.begin(), tried.end(), 0);
+  std::fill(closed.begin(), closed.end(), 0);
+}
+
+//    SolverContext
+SolverContext::SolverContext(unsigned long long seed):
+  seed(seed), rng(seed), deadline(std::chrono::steady_clock::time_point::max()), target(-INF),
+  iterations(0), moves(0), lk_depth(LK_DEPTH), lk_breadth(LK_BREADTH), lk_stats(nullptr) { }
+
+// Sub-stream t is 2^128 * (t + 1) draws ahead, so it never overlaps the parent or
+// the other sub-streams
+SolverContext SolverContext::stream(int t) const {
+  SolverContext ctx(*this);
+  for (int i=0; i<=t; i++) {
+    ctx.rng.jump();
+  }
+  return ctx;
+}
+
+void SolverContext::set_time_limit(double seconds) {
+  deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+bool SolverContext::done(double best) const {
+  return best <= target || std::chrono::steady_clock::now() >= deadline;
+}
+
+void SolverContext::improved(const std::vector<int> &tour, double len) const {
+  if (on_improve) {
+    on_improve(tour, len);
+  }
+}
+
+//    ActiveQueue
+ActiveQueue::ActiveQueue(int size): queue(size), active(size, false), head(0), queued(0) { }
+
+void ActiveQueue::push(int id) {
+  if (!active[id]) {
+    active[id] = true;
+    queue[(head + queued) % queue.size()] = id;
+    queued++;
+  }
+}
+
+void ActiveQueue::push_all() {
+  for (int i=0; i<static_cast<int>(queue.size()); i++) {
+    push(i);
+  }
+}
+
+int ActiveQueue::pop() {
+  int id = queue[head];
+  head = (head + 1) % queue.size();
+  queued--;
+  active[id] = false;
+  return id;
+}
+
+bool ActiveQueue::empty() {
+  return queued == 0;
+}
+
+//    Workspace
+Workspace::Workspace(): queue(0) { }
+
+void Workspace::reserve(int n) {
+  if (static_cast<int>(queue.queue.size()) != n) {
+    queue = ActiveQueue(n);
+    visited.reserve(n);
+    candidates.reserve(n);
+    possibilities.reserve(n);
+  }
+}
+
+//    Moves
+double TwoOptMove::delta(const Graph &g) const {
+  return g.dist(a, c) + g.dist(b, d) - g.dist(a, b) - g.dist(c, d);
+}
+
+template <class Tour>
+void TwoOptMove::apply(const Graph &g, Tour &cycle) const {
+  cycle.len += delta(g);
+  cycle.flip(a, b, d, c);
+  CHECK_TOUR(g, cycle, "TwoOptMove");
+}
+
+double ThreeOptMove::delta(const Graph &g) const {
+  double add = reversed ? g.dist(e, c) + g.dist(b, f) : g.dist(e, b) + g.dist(c, f);
+  return g.dist(a, d) + add - g.dist(a, b) - g.dist(c, d) - g.dist(e, f);
+}
+
+// a->b..c->d..e->f  =>  a->e..d->c..b->f  =>  a->d..e->c..b->f  (=>  a->d..e->b..c->f)
+template <class Tour>
+void ThreeOptMove::apply(const Graph &g, Tour &cycle) const {
+  cycle.len += delta(g);
+  cycle.flip(a, b, f, e);
+  cycle.flip(a, e, c, d);
+  if (!reversed) {
+    cycle.flip(e, c, f, b);
+  }
+  CHECK_TOUR(g, cycle, "ThreeOptMove");
+}
+
+ThreeOptMove OrOptMove::segment() const {
+  return {p, s1, s2, nx, e, f, reversed};
+}
+
+double OrOptMove::delta(const Graph &g) const {
+  return segment().delta(g);
+}
+
+template <class Tour>
+void OrOptMove::apply(const Graph &g, Tour &cycle) const {
+  segment().apply(g, cycle);
+}
+
+static void check_positions(HamiltonianCycle &cycle, int n, const char *where) {
+  for (int i=0; i<n; i++) {
+    if (cycle.positions[cycle.tour[i]] != i) {
+      std::cout << "Solver - check_tour (" << where << "):" << std::endl;
+      std::cout << "Stale position of node " << cycle.tour[i] << std::endl;
+      std::exit(EXIT_FAILURE);
     }
   }
-  itr = 0;
 }
 
-TabuList::~TabuList() {
-  for (int i=0; i<size; i++) {
-    delete[] list[i];
+template <class Tour>
+static void check_positions(Tour&, int, const char*) { }
+
+template <class Tour>
+void check_tour(const Graph &g, Tour &cycle, const char *where) {
+  std::vector<char> seen(g.n, false);
+  double len = 0;
+  int node = 0;
+
+  check_positions(cycle, g.n, where);
+  for (int i=0; i<g.n; i++) {
+    int next = cycle.next(node);
+    if (seen[node] || cycle.prev(next) != node) {
+      std::cout << "Solver - check_tour (" << where << "):" << std::endl;
+      std::cout << "Not a cycle over the " << g.n << " nodes" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    seen[node] = true;
+    len += g.dist(node, next);
+    node = next;
+  }
+  if (node != 0 || std::abs(len - cycle.len) > 1e-6) {
+    std::cout << "Solver - check_tour (" << where << "):" << std::endl;
+    std::cout << "Length " << cycle.len << " differs from the recomputed " << len << std::endl;
+    std::exit(EXIT_FAILURE);
   }
-  delete[] list;
 }
 
 //    Solver
 
 // Constructive
-void greedy_constructive_heuristic(Graph &g) {
-  int size = g.n*(g.n-1)/2;
-  std::vector<Edge> edges(size);
-  int idx = 0;
 
-  // Making vector of edges weighted by distance
-  for (int i=0; i<g.n; i++) {
-    for (int j=i+1; j<g.n; j++) {
-      edges[idx].u = i;
-      edges[idx].v = j;
-      edges[idx].w = g.dist_matrix[i][j];
-      idx++;
+static void join_ends(std::vector<Tuple> &adj, std::vector<int> &degree, int u, int v) {
+  adj[u][degree[u]++] = v;
+  adj[v][degree[v]++] = u;
+}
+
+// Greedy edge matching over the candidate edges (the K nearest neighbors of each node,
+// all pairs when there is no neighbor list): the shortest edge that keeps every degree
+// <= 2 and closes no cycle is taken first. Leaves path fragments in adj.
+static void greedy_fragments(const Graph &g, std::vector<Tuple> &adj, std::vector<int> &degree) {
+  int k = g.sorted_neighbor.width() - 1;
+  DisjointSet set(g.n);
+  int selected = 0;
+  adj.assign(g.n, Tuple{-1, -1});
+  degree.assign(g.n, 0);
+
+  auto take = [&](const Edge &e) {
+    if (degree[e.u] < 2 && degree[e.v] < 2 && set.merge(e.u, e.v)) {
+      join_ends(adj, degree, e.u, e.v);
+      selected++;
+    }
+  };
+  // Ties broken by the endpoints so the tour does not depend on the heap layout
+  auto heavier = [](const Edge &a, const Edge &b) {
+    if (a.w != b.w) return a.w > b.w;
+    if (a.u != b.u) return a.u > b.u;
+    return a.v > b.v;
+  };
+
+  if (k > 0) {
+    // Rows are sorted by distance, so a heap holding the next candidate of each node
+    // yields the candidate edges in increasing order. A node leaves the heap once its
+    // degree is 2 or its row is exhausted.
+    std::vector<int> cursor(g.n, 1);
+    std::priority_queue<Edge, std::vector<Edge>, decltype(heavier)> queue(heavier);
+    for (int i=0; i<g.n; i++) {
+      int j = g.sorted_neighbor[i][1];
+      queue.push({i, j, static_cast<double>(g.dist(i, j))});
+    }
+
+    while (!queue.empty() && selected < g.n-1) {
+      Edge e = queue.top();
+      queue.pop();
+      take(e);
+      if (degree[e.u] < 2 && ++cursor[e.u] <= k) {
+        int j = g.sorted_neighbor[e.u][cursor[e.u]];
+        queue.push({e.u, j, static_cast<double>(g.dist(e.u, j))});
+      }
     }
   }
+  else {
+    std::vector<Edge> edges;
+    edges.reserve(static_cast<size_t>(g.n) * (g.n-1) / 2);
+    for (int i=0; i<g.n; i++) {
+      for (int j=i+1; j<g.n; j++) {
+        edges.push_back({i, j, static_cast<double>(g.dist(i, j))});
+      }
+    }
+    std::sort(edges.begin(), edges.end(), [&](const Edge &a, const Edge &b) {return heavier(b, a);});
+    for (size_t i=0; i<edges.size() && selected < g.n-1; i++) {
+      take(edges[i]);
+    }
+  }
+}
 
-  // sorting by weight
-  std::sort(edges.begin(), edges.end(), compare_edges);
+// Other end of the fragment of each endpoint (itself for isolated nodes), -1 for the
+// inner nodes of the fragments
+static void fragment_ends(const std::vector<Tuple> &adj, const std::vector<int> &degree,
+                          std::vector<int> &other_end, std::vector<int> &ends) {
+  int n = adj.size();
+  other_end.assign(n, -1);
+  ends.clear();
+  for (int i=0; i<n; i++) {
+    if (degree[i] < 2 && other_end[i] == -1) {
+      int prev = i, current = adj[i][0];
+      while (current != -1 && degree[current] == 2) {
+        int next = (adj[current][0] == prev) ? adj[current][1] : adj[current][0];
+        prev = current;
+        current = next;
+      }
+      int end = (current == -1) ? i : current;
+      other_end[i] = end;
+      other_end[end] = i;
+      ends.push_back(i);
+      if (end != i) ends.push_back(end);
+    }
+  }
+}
 
-  // Greedy Selection of edges
-  Edge e;
-  DisjointSet set(g.n);
-  std::vector<Tuple> locations(g.n); // for recreating the cycle in O(n)
-  std::vector<int> flag(g.n, 0); // 0: not selected; 1: tip; 2: middle
-  std::vector<Edge> selected_edges(g.n); // result
-  idx = 0;
+// Cycle of an adjacency where every node has degree 2
+static void cycle_from_adjacency(const Graph &g, HamiltonianCycle &cycle, const std::vector<Tuple> &adj) {
+  cycle.len = 0;
+  int prev = adj[0][1], current = 0;
+  for (int i=0; i<g.n; i++) {
+    cycle.add(current, i);
+    int next = (adj[current][0] == prev) ? adj[current][1] : adj[current][0];
+    cycle.len += g.dist(current, next);
+    prev = current;
+    current = next;
+  }
 
-  for (int i=0; i<size; i++) {
-    e = edges[i];
-    if (flag[e.u] < 2 && flag[e.v] < 2 && find(&set.nodes[e.v]) != find(&set.nodes[e.u])) {
-      merge(&set.nodes[e.v], &set.nodes[e.u]);
-      locations[e.u][flag[e.u]] = idx;
-      flag[e.u]++;
-      locations[e.v][flag[e.v]] = idx;
-      flag[e.v]++;
-      selected_edges[idx] = e;
-      g.cycle.len += g.dist_matrix[e.u][e.v];
-      idx++;
-    }
-    else if (flag[e.u] == 1 && flag[e.v] == 1 && idx == g.n-1) {
-      locations[e.u][flag[e.u]] = idx;
-      locations[e.v][flag[e.v]] = idx;
-      selected_edges[idx] = e;
-      g.cycle.len += g.dist_matrix[e.u][e.v];
-      break;
-    }
-  }
-
-  // Making cycle
-  int current_idx = 0, current_node = selected_edges[0].v;
-  idx = 0;
-
-  g.cycle.add(selected_edges[0].u, idx);
-  idx++;
-  g.cycle.add(selected_edges[0].v, idx);
-  idx++;
-
-  for (int i = 2; i<g.n; i++) {
-    if (locations[current_node][0] == current_idx) {
-      current_idx = locations[current_node][1];
+  cycle.valid = true;
+}
+
+// Greedy matching, then the fragments are chained greedily, each end joined to the
+// nearest end of an unused fragment
+void greedy_constructive_heuristic(Graph &g) {
+  greedy_constructive_heuristic(g, g.cycle);
+}
+
+void greedy_constructive_heuristic(const Graph &g, HamiltonianCycle &cycle) {
+  STATS_PHASE(PHASE_CONSTRUCT);
+  std::vector<Tuple> adj;
+  std::vector<int> degree, other_end, ends;
+  greedy_fragments(g, adj, degree);
+  fragment_ends(adj, degree, other_end, ends);
+
+  // Nearest fragment pass, by the k-d tree when there are coordinates
+  bool spatial = !g.coords.empty() && ends.size() > 2;
+  KdTree tree;
+  std::vector<std::pair<double, int> > nearest;
+  std::vector<char> open(g.n, false);
+  if (spatial) {
+    if (g.kdtree) {
+      tree = *g.kdtree;
     }
     else {
-      current_idx = locations[current_node][0];
+      tree.build(g.coords);
+    }
+    for (int i=0; i<g.n; i++) {
+      if (degree[i] == 2) tree.remove(i);
     }
+  }
+  for (int i : ends) {
+    open[i] = true;
+  }
 
-    if (selected_edges[current_idx].u == current_node) {
-      current_node = selected_edges[current_idx].v;
+  auto close = [&](int i) {
+    open[i] = false;
+    if (spatial) tree.remove(i);
+  };
+
+  int first = ends[0], tail = other_end[first];
+  close(first);
+  close(tail);
+  for (int joined=(tail == first ? 1 : 2); joined < static_cast<int>(ends.size()); ) {
+    int best = -1;
+    if (spatial) {
+      tree.nearest_k(tail, 1, nearest);
+      best = nearest.empty() ? -1 : nearest[0].second;
     }
     else {
-      current_node = selected_edges[current_idx].u;
+      double min = INF;
+      for (int i : ends) {
+        if (open[i] && g.dist(tail, i) < min) {
+          min = g.dist(tail, i);
+          best = i;
+        }
+      }
     }
-    g.cycle.add(current_node, idx);
-    idx++;
+    if (best == -1) break;
+
+    join_ends(adj, degree, tail, best);
+    close(best);
+    close(other_end[best]);
+    joined += (other_end[best] == best) ? 1 : 2;
+    tail = other_end[best];
   }
+  join_ends(adj, degree, tail, first);
 
-  g.cycle.valid = true;
+  cycle_from_adjacency(g, cycle, adj);
+}
+
+// Hilbert index of (x, y) on a HILBERT_SIDE x HILBERT_SIDE grid
+static unsigned long long hilbert_index(unsigned x, unsigned y) {
+  unsigned long long d = 0;
+  for (unsigned s=HILBERT_SIDE/2; s>0; s/=2) {
+    unsigned rx = (x & s) > 0;
+    unsigned ry = (y & s) > 0;
+    d += static_cast<unsigned long long>(s) * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = HILBERT_SIDE-1 - x;
+        y = HILBERT_SIDE-1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
 }
 
-void randomize_nearest_neighbor(Graph &g, float a) {
-  std::vector<bool> visited(g.n, false);
-  std::vector<int> candidates_list;
-  std::vector<int> possibility_list;
-  unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine generator (seed);
-  std::uniform_int_distribution<int> dist(0, g.n-1);
-  int current = dist(generator);
+// Nodes sorted along the Hilbert curve over the bounding box of the coordinates. The
+// indices are computed and the chunks sorted in parallel, then the chunks are merged.
+static void hilbert_order(const Graph &g, std::vector<int> &order) {
+  Point lo = g.coords[0], hi = g.coords[0];
+  for (const Point &p : g.coords) {
+    lo.x = std::min(lo.x, p.x);
+    lo.y = std::min(lo.y, p.y);
+    hi.x = std::max(hi.x, p.x);
+    hi.y = std::max(hi.y, p.y);
+  }
+  double side = std::max(hi.x - lo.x, hi.y - lo.y);
+  double scale = (side > 0) ? (HILBERT_SIDE - 1) / side : 0;
+
+  int threads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), g.n / 65536 + 1));
+  std::vector<std::pair<unsigned long long, int> > keys(g.n);
+  std::vector<int> bounds(threads + 1);
+  for (int t=0; t<=threads; t++) {
+    bounds[t] = static_cast<long long>(g.n) * t / threads;
+  }
+
+  std::vector<std::thread> workers;
+  for (int t=0; t<threads; t++) {
+    workers.emplace_back([&, t]() {
+      for (int i=bounds[t]; i<bounds[t+1]; i++) {
+        unsigned x = static_cast<unsigned>((g.coords[i].x - lo.x) * scale);
+        unsigned y = static_cast<unsigned>((g.coords[i].y - lo.y) * scale);
+        keys[i] = std::make_pair(hilbert_index(x, y), i);
+      }
+      std::sort(keys.begin() + bounds[t], keys.begin() + bounds[t+1]);
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  for (int t=1; t<threads; t++) {
+    std::inplace_merge(keys.begin(), keys.begin() + bounds[t], keys.begin() + bounds[t+1]);
+  }
+
+  order.resize(g.n);
+  for (int i=0; i<g.n; i++) {
+    order[i] = keys[i].second;
+  }
+}
 
-  g.cycle.len = 0;
-  g.cycle.add(current, 0);
-  candidates_list.reserve(g.n);
-  possibility_list.reserve(g.n);
+// Tour visiting the nodes in Hilbert curve order, O(n log n). Falls back to the greedy
+// on instances without coordinates.
+void space_filling_curve(Graph &g) {
+  space_filling_curve(g, g.cycle);
+}
+
+void space_filling_curve(const Graph &g, HamiltonianCycle &cycle) {
+  if (g.coords.empty()) {
+    greedy_constructive_heuristic(g, cycle);
+    return;
+  }
+  STATS_PHASE(PHASE_CONSTRUCT);
+  std::vector<int> order;
+  hilbert_order(g, order);
+
+  cycle.len = 0;
+  for (int i=0; i<g.n; i++) {
+    cycle.add(order[i], i);
+    cycle.len += g.dist(order[i], order[(i+1) % g.n]);
+  }
+  cycle.valid = true;
+}
+
+// Greedy matching, then the fragments are chained in the order their first end appears
+// on the Hilbert curve, which replaces the nearest fragment pass by a linear sweep.
+// Falls back to the greedy on instances without coordinates.
+void greedy_space_filling_curve(Graph &g) {
+  greedy_space_filling_curve(g, g.cycle);
+}
+
+void greedy_space_filling_curve(const Graph &g, HamiltonianCycle &cycle) {
+  if (g.coords.empty()) {
+    greedy_constructive_heuristic(g, cycle);
+    return;
+  }
+  STATS_PHASE(PHASE_CONSTRUCT);
+  std::vector<Tuple> adj;
+  std::vector<int> degree, other_end, ends, order;
+  greedy_fragments(g, adj, degree);
+  fragment_ends(adj, degree, other_end, ends);
+  hilbert_order(g, order);
+
+  std::vector<char> used(g.n, false);
+  int first = -1, tail = -1;
+  for (int i : order) {
+    if (other_end[i] == -1 || used[i]) continue;
+    used[i] = used[other_end[i]] = true;
+    if (first == -1) {
+      first = i;
+    }
+    else {
+      join_ends(adj, degree, tail, i);
+    }
+    tail = other_end[i];
+  }
+  join_ends(adj, degree, tail, first);
+
+  cycle_from_adjacency(g, cycle, adj);
+}
+
+void randomize_nearest_neighbor(Graph &g, float a, SolverContext &ctx) {
+  randomize_nearest_neighbor(g, g.cycle, a, ctx);
+}
+
+void randomize_nearest_neighbor(const Graph &g, HamiltonianCycle &cycle, float a, SolverContext &ctx) {
+  STATS_PHASE(PHASE_CONSTRUCT);
+  Workspace &ws = ctx.ws;
+  ws.reserve(g.n);
+  std::vector<char> &visited = ws.visited;
+  std::vector<int> &candidates_list = ws.candidates;
+  std::vector<int> &possibility_list = ws.possibilities;
+  std::vector<std::pair<double, int> > &nearest = ws.nearest;
+  KdTree &unvisited = ws.unvisited;
+  int current = ctx.rng.uniform(g.n);
+
+  // The k nearest unvisited nodes come from the k-d tree, instances without coordinates
+  // scan every unvisited node
+  bool spatial = g.kdtree != nullptr;
+  int k = std::max(1, g.sorted_neighbor.width() - 1);
+  visited.assign(g.n, false);
+  if (spatial) {
+    unvisited = *g.kdtree;
+  }
+
+  cycle.len = 0;
+  cycle.add(current, 0);
 
   for (int i=1; i<g.n; i++) {
     double max = 0, min = INF;
@@ -168,101 +584,143 @@ void randomize_nearest_neighbor(Graph &g, float a) {
     possibility_list.clear();
     visited[current] = true;
 
-    // Selecting all possible neighbors
-    for (int j=0; j<g.n; j++) {
-      if (!visited[j]) {
-        candidates_list.push_back(j);
-        // Obtaining best neighbor
-        if (g.dist_matrix[current][j] > max) {
-          max = g.dist_matrix[current][j];
-        }
-        // Obtaining worst neighbor
-        if (g.dist_matrix[current][j] < min) {
-          min = g.dist_matrix[current][j];
+    // Selecting the possible neighbors
+    if (spatial) {
+      unvisited.remove(current);
+      unvisited.nearest_k(current, k, nearest);
+      for (std::pair<double, int> &p : nearest) {
+        candidates_list.push_back(p.second);
+      }
+    }
+    else {
+      for (int j=0; j<g.n; j++) {
+        if (!visited[j]) {
+          candidates_list.push_back(j);
         }
       }
     }
 
+    for (int j : candidates_list) {
+      // Obtaining worst neighbor
+      if (g.dist(current, j) > max) {
+        max = g.dist(current, j);
+      }
+      // Obtaining best neighbor
+      if (g.dist(current, j) < min) {
+        min = g.dist(current, j);
+      }
+    }
+
     //std::cout << "cadidates list: " << candidates_list.size() << std::endl;
     // Creating randomize greeedy options
     for (int idx : candidates_list) {
-      if (g.dist_matrix[current][idx] <= min + a * (max - min)) {
+      if (g.dist(current, idx) <= min + a * (max - min)) {
         possibility_list.push_back(idx);
       }
     }
 
     // Random choice
-    dist = std::uniform_int_distribution<int>(0, possibility_list.size()-1);
-    int chosen = possibility_list[dist(generator)];
+    int chosen = possibility_list[ctx.rng.uniform(possibility_list.size())];
 
     // Adding to solution
-    g.cycle.add(chosen, i);
-    g.cycle.len += g.dist_matrix[current][chosen];
+    cycle.add(chosen, i);
+    cycle.len += g.dist(current, chosen);
     current = chosen;
   }
 
   // Adding distance for closing the cycle
-  g.cycle.len += g.dist_matrix[current][g.cycle.tour[0]];
+  cycle.len += g.dist(current, cycle.tour[0]);
+  cycle.valid = true;
 }
 
 // Local Search
-void local_search_vnd(Graph &g, int k) {
+template <class Tour> static bool two_opt_from(const Graph&, Tour&, int, int, ActiveQueue&);
+template <class Tour> static bool or_opt_from(const Graph&, Tour&, int, int, OrOptMove&);
+
+// Restricted: 2-opt then Or-opt from each node of one don't-look bits queue, the
+// endpoints of every applied move are queued again. Otherwise 2-opt with the queue
+// alternates with full 3-opt passes. Returns the number of moves applied
+int local_search_vnd(Graph &g, int k, bool restricted) {
+  STATS_PHASE(PHASE_LOCAL_SEARCH);
+  int moves = 0;
+
   if (!g.cycle.valid) {
     std::cout << "Solver - first_2opt: " << std::endl;
     std::cout << "Local search requires a initial solution" << std::endl;
     std::exit(EXIT_FAILURE);
   }
 
-  while (true) {
-    if (first_2opt(g, k)) {
-      continue;
-    }
-    else if(first_3opt(g)) {
-      continue;
+  ActiveQueue queue(g.n);
+  OrOptMove move;
+  queue.push_all();
+
+  // Second neighborhood: Or-opt on the neighbor lists
+  if (restricted) {
+    while (!queue.empty()) {
+      int a = queue.pop();
+      if (two_opt_from(g, g.cycle, a, k, queue)) {
+        moves++;
+      }
+      else if (g.n >= 8 && or_opt_from(g, g.cycle, a, k, move)) {
+        moves++;
+        for (int node : {move.p, move.s1, move.s2, move.nx, move.e, move.f}) {
+          queue.push(node);
+        }
+      }
     }
-    break;
+    return moves;
+  }
+
+  // or the full 3-opt
+  while (true) {
+    moves += dlb_2opt(g, g.cycle, k, queue);
+    if (!first_3opt(g)) break;
+    moves++;
+    queue.push_all();
   }
+  return moves;
 }
 
 bool first_2opt(Graph &g, int k) {
+  return first_2opt(g, g.cycle, k);
+}
+
+template <class Tour>
+bool first_2opt(const Graph &g, Tour &cycle, int k) {
   char orientation[2] = {'f', 'b'};
   int a, b, c, d;
-  int i, j;
-  double add, loss;
 
-  for (int idx1=0; idx1<g.n; idx1++) {
+  for (a=0; a<g.n; a++) {
 
     for (char direction : orientation) {
       if (direction == 'f') {
-        a = g.cycle.tour[idx1];
-        b = g.cycle.next(a);
-        i = g.cycle.positions[a];
+        b = cycle.next(a);
       }
       else {
-        a = g.cycle.tour[idx1];
-        b = g.cycle.prev(a);
-        i = g.cycle.positions[b];
+        b = cycle.prev(a);
       }
 
-      for (int idx2=1; idx2<=k; idx2++) {
+      int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+      for (int idx2=1; idx2<=k_max; idx2++) {
         c = g.sorted_neighbor[a][idx2];
         if (direction == 'f') {
-          j = g.cycle.positions[c];
-          d = g.cycle.next(c);
+          d = cycle.next(c);
         }
         else {
-          d = g.cycle.prev(c);
-          j = g.cycle.positions[d];
+          d = cycle.prev(c);
         }
 
         if (b == c || d == a) continue;
-        if (g.dist_matrix[a][c] > g.dist_matrix[a][b]) break;
+        if (g.dist(a, c) > g.dist(a, b)) {
+          STATS_INC(pruned);
+          break;
+        }
 
-        add = g.dist_matrix[a][c] + g.dist_matrix[b][d];
-        loss = g.dist_matrix[a][b] + g.dist_matrix[c][d];
-        if (loss > add) {
-          g.cycle.reverse( (i+1) % g.n, j );
-          g.cycle.len = g.cycle.len + add - loss;
+        TwoOptMove move = {a, b, c, d};
+        STATS_INC(evaluated);
+        if (move.delta(g) < 0) {
+          STATS_INC(applied);
+          move.apply(g, cycle);
           return true;
         }
       }
@@ -272,53 +730,51 @@ bool first_2opt(Graph &g, int k) {
 }
 
 bool first_2opt(Graph &g, int k, TabuList &tl) {
+  return first_2opt(g, g.cycle, k, tl);
+}
+
+template <class Tour>
+bool first_2opt(const Graph &g, Tour &cycle, int k, TabuList &tl) {
+  STATS_PHASE(PHASE_LOCAL_SEARCH);
   char orientation[2] = {'f', 'b'};
   int a, b, c, d;
-  int i, j;
-  double add, loss;
 
-  for (int idx1=0; idx1<g.n; idx1++) {
+  for (a=0; a<g.n; a++) {
 
     for (char direction : orientation) {
       if (direction == 'f') {
-        a = g.cycle.tour[idx1];
-        b = g.cycle.next(a);
-        i = g.cycle.positions[a];
+        b = cycle.next(a);
       }
       else {
-        a = g.cycle.tour[idx1];
-        b = g.cycle.prev(a);
-        i = g.cycle.positions[b];
+        b = cycle.prev(a);
       }
 
-      for (int idx2=1; idx2<=k; idx2++) {
+      int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+      for (int idx2=1; idx2<=k_max; idx2++) {
         c = g.sorted_neighbor[a][idx2];
         if (direction == 'f') {
-          j = g.cycle.positions[c];
-          d = g.cycle.next(c);
+          d = cycle.next(c);
         }
         else {
-          d = g.cycle.prev(c);
-          j = g.cycle.positions[d];
+          d = cycle.prev(c);
         }
 
         if (b == c || d == a) continue;
-        if (g.dist_matrix[a][c] > g.dist_matrix[a][b]) break;
-
-        add = g.dist_matrix[a][c] + g.dist_matrix[b][d];
-        loss = g.dist_matrix[a][b] + g.dist_matrix[c][d];
-        if (loss > add) {
-          g.cycle.reverse( (i+1) % g.n, j );
-          g.cycle.len = g.cycle.len + add - loss;
-          if (g.dist_matrix[a][b] < g.dist_matrix[c][d]) {
-            tl.list[a][b] = tl.itr + tl.tabu_time;
-            tl.list[b][a] = tl.itr + tl.tabu_time;
-            tl.itr++;
+        if (g.dist(a, c) > g.dist(a, b)) {
+          STATS_INC(pruned);
+          break;
+        }
+
+        TwoOptMove move = {a, b, c, d};
+        STATS_INC(evaluated);
+        if (move.delta(g) < 0) {
+          STATS_INC(applied);
+          move.apply(g, cycle);
+          if (g.dist(a, b) < g.dist(c, d)) {
+            tl.add(a, b);
           }
           else {
-            tl.list[c][d] = tl.itr + tl.tabu_time;
-            tl.list[d][c] = tl.itr + tl.tabu_time;
-            tl.itr++;
+            tl.add(c, d);
           }
           return true;
         }
@@ -328,18 +784,166 @@ bool first_2opt(Graph &g, int k, TabuList &tl) {
   return false;
 }
 
+int dlb_2opt(Graph &g, int k) {
+  return dlb_2opt(g, g.cycle, k);
+}
+
+// First improvement 2-opt with don't-look bits: only nodes in the FIFO queue are
+// scanned and the endpoints of the changed edges are queued again after a move.
+// Returns the number of moves applied.
+template <class Tour>
+int dlb_2opt(const Graph &g, Tour &cycle, int k) {
+  ActiveQueue queue(g.n);
+  queue.push_all();
+  return dlb_2opt(g, cycle, k, queue);
+}
+
+// First improving 2-opt move of a (both directions), applied. The endpoints of the
+// changed edges are queued again.
+template <class Tour>
+static bool two_opt_from(const Graph &g, Tour &cycle, int a, int k, ActiveQueue &queue) {
+  char orientation[2] = {'f', 'b'};
+  int b, c, d;
+
+  for (char direction : orientation) {
+    if (direction == 'f') {
+      b = cycle.next(a);
+    }
+    else {
+      b = cycle.prev(a);
+    }
+
+    int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+    for (int idx2=1; idx2<=k_max; idx2++) {
+      c = g.sorted_neighbor[a][idx2];
+      if (direction == 'f') {
+        d = cycle.next(c);
+      }
+      else {
+        d = cycle.prev(c);
+      }
+
+      if (b == c || d == a) continue;
+      if (g.dist(a, c) > g.dist(a, b)) {
+        STATS_INC(pruned);
+        break;
+      }
+
+      TwoOptMove move = {a, b, c, d};
+      STATS_INC(evaluated);
+      if (move.delta(g) < 0) {
+        STATS_INC(applied);
+        move.apply(g, cycle);
+        // a is queued again together with the endpoints of the new edges
+        for (int node : {a, b, c, d}) {
+          queue.push(node);
+        }
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+template <class Tour>
+int dlb_2opt(const Graph &g, Tour &cycle, int k, ActiveQueue &queue) {
+  int moves = 0;
+
+  while (!queue.empty()) {
+    if (two_opt_from(g, cycle, queue.pop(), k, queue)) {
+      moves++;
+    }
+  }
+  return moves;
+}
+
 void best_2opt(Graph &g, TabuList &tl) {
+  best_2opt(g, g.cycle, tl);
+}
+
+// Gains of the 2-opt moves (a, b, c, d) of one row of best_2opt, with a = order[i],
+// b = order[i+1], c = order[j] and d = order[j+1]. ra and rb are the distance rows
+// of a and b in tour order, edge[j] = d(c, d) and tabu moves are masked by -1 entries.
+// Returns the max gain of the row, INT_MIN when every move is tabu
+static int two_opt_gains_scalar(int dab, const int *edge, const int *ra, const int *rb,
+                                const int *mask, int from, int to, int *gain) {
+  int best = std::numeric_limits<int>::min();
+  for (int j=from; j<to; j++) {
+    gain[j] = mask[j] ? std::numeric_limits<int>::min() : dab + edge[j] - ra[j] - rb[j+1];
+    best = std::max(best, gain[j]);
+  }
+  return best;
+}
+
+#ifdef SOLVER_AVX2
+__attribute__((target("avx2")))
+static int two_opt_gains_avx2(int dab, const int *edge, const int *ra, const int *rb,
+                              const int *mask, int from, int to, int *gain) {
+  const __m256i vdab = _mm256_set1_epi32(dab);
+  const __m256i vmin = _mm256_set1_epi32(std::numeric_limits<int>::min());
+  __m256i vbest = vmin;
+
+  int j = from;
+  for (; j+8<=to; j+=8) {
+    __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(edge + j));
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ra + j));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rb + j + 1));
+    __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + j));
+    __m256i g = _mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(vdab, e), a), b);
+    g = _mm256_blendv_epi8(g, vmin, m);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(gain + j), g);
+    vbest = _mm256_max_epi32(vbest, g);
+  }
+
+  int lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), vbest);
+  int best = two_opt_gains_scalar(dab, edge, ra, rb, mask, j, to, gain);
+  for (int lane : lanes) {
+    best = std::max(best, lane);
+  }
+  return best;
+}
+#endif
+
+typedef int (*GainKernel)(int, const int*, const int*, const int*, const int*, int, int, int*);
+
+bool two_opt_kernel_supported(TwoOptKernel kernel) {
+  if (kernel != KERNEL_AVX2) return true;
+#ifdef SOLVER_AVX2
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+// KERNEL_AUTO takes AVX2 when the CPU has it
+static GainKernel gain_kernel(TwoOptKernel kernel) {
+  if (!two_opt_kernel_supported(kernel)) {
+    std::cout << "Solver - gain_kernel:" << std::endl;
+    std::cout << "AVX2 kernel not supported on this CPU" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+#ifdef SOLVER_AVX2
+  if (kernel == KERNEL_AVX2 || (kernel == KERNEL_AUTO && two_opt_kernel_supported(KERNEL_AVX2))) {
+    return two_opt_gains_avx2;
+  }
+#endif
+  return two_opt_gains_scalar;
+}
+
+// Plain scan of every move, reference of the kernel version below (checked in TSP_DEBUG
+// builds and by make test)
+template <class Tour>
+Move best_2opt_scan(const Graph &g, Tour &cycle, TabuList &tl) {
   int a, b, c, d;
   int max_count2;
-  Move best;
+  Move best = {-1, -1, -1, -1, -1, -1, -INF};
   double add, loss, gain;
-  bool flag = false;
-
-  best.gain = -INF;
 
-  for (int i=0; i<g.n-2; i++) {
-    a = g.cycle.tour[i];
-    b = g.cycle.next(a);
+  // Tour is walked from node 0, i and j are offsets from it
+  a = 0;
+  for (int i=0; i<g.n-2; i++, a=b) {
+    b = cycle.next(a);
 
     if (i == 0) {
       max_count2 = g.n-2;
@@ -348,41 +952,120 @@ void best_2opt(Graph &g, TabuList &tl) {
       max_count2 = g.n-1;
     }
 
-    for (int j=i+2; j<=max_count2; j++) {
-      c = g.cycle.tour[j];
-      d = g.cycle.next(c);
+    c = cycle.next(b);
+    for (int j=i+2; j<=max_count2; j++, c=d) {
+      d = cycle.next(c);
 
-      if (tl.list[a][c] > tl.itr || tl.list[b][d] > tl.itr) {
+      if (tl.is_tabu(a, c) || tl.is_tabu(b, d)) {
         continue;
       }
 
-      add = g.dist_matrix[a][c] + g.dist_matrix[b][d];
-      loss = g.dist_matrix[a][b] + g.dist_matrix[c][d];
+      add = g.dist(a, c) + g.dist(b, d);
+      loss = g.dist(a, b) + g.dist(c, d);
       gain = loss - add;
 
       if (gain > best.gain) {
-        flag = true;
-        best.i = i;
-        best.j = j;
+        best.a = a;
+        best.b = b;
+        best.c = c;
+        best.d = d;
         best.gain = gain;
-
-        if (g.dist_matrix[a][b] < g.dist_matrix[c][d]) {
-          best.u = a;
-          best.v = b;
-        }
-        else {
-          best.u = c;
-          best.v = d;
-        }
       }
     }
   }
+  return best;
+}
+
+// Best non tabu 2-opt move over every pair of tour edges, gain -INF when every move is
+// tabu. The distance row of each node is gathered in tour order once (it serves as the
+// row of a and then of b), and the gains of a row are evaluated by the SIMD kernel with
+// the tabu moves masked out. Ties go to the first move in scan order, as in best_2opt_scan.
+template <class Tour>
+Move best_2opt_move(const Graph &g, Tour &cycle, TabuList &tl, TwoOptKernel which) {
+  int n = g.n;
+  Move best = {-1, -1, -1, -1, -1, -1, -INF};
+  GainKernel kernel = gain_kernel(which);
+
+  std::vector<int> order(n), pos(n), edge(n+1);
+  std::vector<int> ra(n+1), rb(n+1), mask(n+1, 0), gain(n+1);
+
+  order[0] = 0;
+  for (int p=1; p<n; p++) {
+    order[p] = cycle.next(order[p-1]);
+  }
+  for (int p=0; p<n; p++) {
+    pos[order[p]] = p;
+    edge[p] = g.dist(order[p], order[(p+1) % n]);
+  }
+
+  auto gather = [&](int node, std::vector<int> &row) {
+    for (int p=0; p<n; p++) {
+      row[p] = g.dist(node, order[p]);
+    }
+    row[n] = row[0];
+  };
+
+  if (n > 2) gather(order[0], ra);
+  for (int i=0; i<n-2; i++) {
+    int a = order[i], b = order[i+1];
+    int to = (i == 0) ? n-1 : n;
+    gather(b, rb);
+
+    // (a, c) tabu masks c = order[j], (b, d) tabu masks d = order[j+1]
+    for (std::pair<int, int> &entry : tl.list[a]) {
+      if (entry.second > tl.itr) mask[pos[entry.first]] = -1;
+    }
+    for (std::pair<int, int> &entry : tl.list[b]) {
+      if (entry.second > tl.itr) mask[(pos[entry.first] + n - 1) % n] = -1;
+    }
+
+    int row_best = kernel(edge[i], edge.data(), ra.data(), rb.data(), mask.data(), i+2, to, gain.data());
+    STATS_ADD(evaluated, to - (i+2));
+    if (row_best != std::numeric_limits<int>::min() && row_best > best.gain) {
+      int j = i+2;
+      while (gain[j] != row_best) j++;
+      best.a = a;
+      best.b = b;
+      best.c = order[j];
+      best.d = order[(j+1) % n];
+      best.gain = row_best;
+    }
+
+    for (std::pair<int, int> &entry : tl.list[a]) mask[pos[entry.first]] = 0;
+    for (std::pair<int, int> &entry : tl.list[b]) mask[(pos[entry.first] + n - 1) % n] = 0;
+    ra.swap(rb);
+  }
+  return best;
+}
+
+template <class Tour>
+void best_2opt(const Graph &g, Tour &cycle, TabuList &tl) {
+  STATS_PHASE(PHASE_LOCAL_SEARCH);
+  Move best = best_2opt_move(g, cycle, tl);
+  bool flag = best.gain != -INF;
+
+#ifdef TSP_DEBUG
+  Move check = best_2opt_scan(g, cycle, tl);
+  if (check.gain != best.gain || (flag && (check.a != best.a || check.c != best.c))) {
+    std::cout << "Solver - best_2opt:" << std::endl;
+    std::cout << "Kernel move differs from the plain scan" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+#endif
+
   if (flag) {
-    g.cycle.reverse((best.i + 1)% g.n, best.j);
-    g.cycle.len -= best.gain;
-    tl.list[best.u][best.v] = tl.itr + tl.tabu_time;
-    tl.list[best.v][best.u] = tl.itr + tl.tabu_time;
-    tl.itr++;
+    STATS_INC(applied);
+    if (g.dist(best.a, best.b) < g.dist(best.c, best.d)) {
+      best.u = best.a;
+      best.v = best.b;
+    }
+    else {
+      best.u = best.c;
+      best.v = best.d;
+    }
+    TwoOptMove move = {best.a, best.b, best.c, best.d};
+    move.apply(g, cycle);
+    tl.add(best.u, best.v);
   }
   else {
     std::cout << "Todos são tabus" << std::endl;
@@ -391,46 +1074,95 @@ void best_2opt(Graph &g, TabuList &tl) {
 }
 
 bool first_3opt(Graph &g) {
-  int moves_opt3[2] = { 1, 2 };
+  return first_3opt(g, g.cycle);
+}
+
+template <class Tour>
+bool first_3opt(const Graph &g, Tour &cycle) {
   int a, b, c, d, e, f;
-  int i, j, k;
-  double add, loss;
-
-  for (int idx1=0; idx1<g.n; idx1++) {
-    i = idx1;
-    a = g.cycle.tour[i];
-    b = g.cycle.next(a);
-
-    for (int idx2=2; idx2<g.n-2; idx2++) {
-      j = (i + idx2) % g.n;
-      c = g.cycle.tour[j];
-      d = g.cycle.next(c);
-
-      for (int idx3=idx2+2; idx3<g.n; idx3++) {
-        k = (i + idx3) % g.n;
-        e = g.cycle.tour[k];
-        f = g.cycle.next(e);
-
-        for (int move : moves_opt3) {
-          if (move == 1) {
-            add = g.dist_matrix[a][d] + g.dist_matrix[e][c] + g.dist_matrix[f][b];
+
+  for (a=0; a<g.n; a++) {
+    b = cycle.next(a);
+
+    c = cycle.next(b);
+    for (int idx2=2; idx2<g.n-2; idx2++, c=d) {
+      d = cycle.next(c);
+
+      e = cycle.next(d);
+      for (int idx3=idx2+2; idx3<g.n; idx3++, e=f) {
+        f = cycle.next(e);
+
+        // a->b..c->d..e->f becomes a->d..e->c..b->f (reversed) or a->d..e->b..c->f
+        for (bool reversed : {true, false}) {
+          ThreeOptMove move = {a, b, c, d, e, f, reversed};
+          STATS_INC(evaluated);
+
+          if (move.delta(g) < 0) {
+            STATS_INC(applied);
+            move.apply(g, cycle);
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+bool first_or_opt(Graph &g, int k) {
+  return first_or_opt(g, g.cycle, k);
+}
+
+// First improving Or-opt move of the segments starting at s1, applied and returned in move
+template <class Tour>
+static bool or_opt_from(const Graph &g, Tour &cycle, int s1, int k, OrOptMove &move) {
+  int segment[3];
+  int p, s2, nx, c, e, f;
+  double removal;
+
+  p = cycle.prev(s1);
+  s2 = s1;
+
+  for (int len=1; len<=3; len++) {
+    if (len > 1) s2 = cycle.next(s2);
+    segment[len-1] = s2;
+    nx = cycle.next(s2);
+
+    removal = g.dist(p, s1) + g.dist(s2, nx) - g.dist(p, nx);
+    if (removal <= 0) continue;
+
+    // end 0: new edge (s1, c), end 1: new edge (s2, c)
+    for (int end=0; end<2; end++) {
+      int s = (end == 0) ? s1 : s2;
+      int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+
+      for (int idx=1; idx<=k_max; idx++) {
+        c = g.sorted_neighbor[s][idx];
+        if (g.dist(s, c) >= removal) {
+          STATS_INC(pruned);
+          break;
+        }
+        if (std::find(segment, segment + len, c) != segment + len) continue;
+
+        // side 0: inserted between c and next(c), side 1: between prev(c) and c
+        for (int side=0; side<2; side++) {
+          if (side == 0) {
+            e = c;
+            f = cycle.next(c);
           }
           else {
-            add = g.dist_matrix[a][d] + g.dist_matrix[e][b] + g.dist_matrix[c][f];
+            e = cycle.prev(c);
+            f = c;
           }
-          loss = g.dist_matrix[a][b] + g.dist_matrix[c][d] + g.dist_matrix[e][f];
-
-          if (loss > add) {
-            if (move == 1) {
-              g.cycle.reverse( (k+1) % g.n, i);
-              g.cycle.reverse( (j+1) % g.n, k);
-            }
-            else {
-              g.cycle.reverse( (k+1) % g.n, i);
-              g.cycle.reverse( (i+1) % g.n, j);
-              g.cycle.reverse( (j+1) % g.n, k);
-            }
-            g.cycle.len = g.cycle.len + add - loss;
+          if (std::find(segment, segment + len, e) != segment + len) continue;
+          if (std::find(segment, segment + len, f) != segment + len) continue;
+
+          // s1 follows e when it is not reversed
+          move = {p, s1, s2, nx, e, f, (s == s1) != (side == 0)};
+          STATS_INC(evaluated);
+          if (move.delta(g) < 0) {
+            STATS_INC(applied);
+            move.apply(g, cycle);
             return true;
           }
         }
@@ -440,33 +1172,661 @@ bool first_3opt(Graph &g) {
   return false;
 }
 
+// Or-opt: segments of 1 to 3 nodes are moved next to one of the k nearest neighbors of
+// one of their endpoints. As in first_2opt, the scan of a neighbor list stops once the
+// new edge is longer than the gain of removing the segment.
+template <class Tour>
+bool first_or_opt(const Graph &g, Tour &cycle, int k) {
+  OrOptMove move;
+
+  if (g.n < 8) return false;
+
+  for (int s1=0; s1<g.n; s1++) {
+    if (or_opt_from(g, cycle, s1, k, move)) return true;
+  }
+  return false;
+}
+
+// Lin-Kernighan step as a sequence of flips. The tour is seen as a path from t2 to t1:
+// each level adds (t2, t3), removes (t4, t3) and closes with (t4, t1).
+template <class Tour>
+struct LKSearch {
+  const Graph &g;
+  Tour &cycle;
+  int k, max_depth, breadth;
+  LKStats *stats;
+
+  std::vector<std::array<int, 4> > flips;   // applied flips (t1, t2, t3, t4)
+  std::vector<Tuple> added;                 // edges added in the current move
+  std::vector<std::array<double, 3> > options;
+  double best_gain;
+  int best_depth;
+
+  LKSearch(const Graph &g, Tour &cycle, int k, int max_depth, int breadth, LKStats *stats):
+    g(g), cycle(cycle), k(k), max_depth(max_depth), breadth(breadth), stats(stats) {
+    if (stats != nullptr) {
+      stats->tried.resize(max_depth + 1, 0);
+      stats->closed.resize(max_depth + 1, 0);
+    }
+  }
+
+  // Move from t1 in either direction, every endpoint of the kept flips is queued again
+  bool improve_from(int t1, ActiveQueue &queue) {
+    if (!improve(t1, cycle.next(t1)) && !improve(t1, cycle.prev(t1))) {
+      return false;
+    }
+    for (std::array<int, 4> &f : flips) {
+      for (int node : f) {
+        queue.push(node);
+      }
+    }
+    return true;
+  }
+
+  bool was_added(int u, int v) {
+    for (Tuple &e : added) {
+      if ((e[0] == u && e[1] == v) || (e[0] == v && e[1] == u)) return true;
+    }
+    return false;
+  }
+
+  void undo() {
+    std::array<int, 4> &f = flips.back();
+    cycle.flip(f[0], f[3], f[2], f[1]);
+    flips.pop_back();
+  }
+
+  // Breadth only at the first two levels, the deeper levels are greedy
+  bool search(int depth, int t1, int t2, double gain) {
+    bool forward = (cycle.next(t1) == t2);
+    int width = (depth <= 2) ? breadth : 1;
+    int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+    size_t first = options.size();
+
+    // Candidates t3 sorted by d(t3, t4) - d(t2, t3)
+    for (int idx=1; idx<=k_max; idx++) {
+      int t3 = g.sorted_neighbor[t2][idx];
+      double g1 = gain - g.dist(t2, t3);
+      if (g1 <= 0) {
+        STATS_INC(pruned);
+        break;
+      }
+
+      int t4 = forward ? cycle.prev(t3) : cycle.next(t3);
+      if (t3 == t1 || t4 == t2 || t4 == t1 || was_added(t3, t4)) continue;
+
+      options.push_back({static_cast<double>(g.dist(t3, t4) - g.dist(t2, t3)), static_cast<double>(t3), static_cast<double>(t4)});
+    }
+    std::sort(options.begin() + first, options.end(),
+      [](const std::array<double, 3> &a, const std::array<double, 3> &b) {return a[0] > b[0];});
+    size_t last = std::min(options.size(), first + width);
+
+    for (size_t i=first; i<last; i++) {
+      int t3 = options[i][1], t4 = options[i][2];
+      double g2 = gain - g.dist(t2, t3) + g.dist(t3, t4);
+
+      cycle.flip(t1, t2, t3, t4);
+      flips.push_back({t1, t2, t3, t4});
+      added.push_back({t2, t3});
+      STATS_INC(evaluated);
+      if (stats != nullptr) stats->tried[depth]++;
+
+      if (g2 - g.dist(t4, t1) > best_gain) {
+        best_gain = g2 - g.dist(t4, t1);
+        best_depth = depth;
+      }
+      if (depth < max_depth) {
+        search(depth + 1, t1, t4, g2);
+      }
+      if (best_gain > 0) {
+        options.resize(first);
+        return true;
+      }
+
+      added.pop_back();
+      undo();
+    }
+    options.resize(first);
+    return false;
+  }
+
+  // Tries to improve the tour starting by removing (t1, t2)
+  bool improve(int t1, int t2) {
+    flips.clear();
+    added.clear();
+    best_gain = 0;
+    best_depth = 0;
+
+    if (!search(1, t1, t2, g.dist(t1, t2))) {
+      return false;
+    }
+    while (static_cast<int>(flips.size()) > best_depth) {
+      undo();
+    }
+    cycle.len -= best_gain;
+    CHECK_TOUR(g, cycle, "lin_kernighan");
+    STATS_INC(applied);
+    if (stats != nullptr) stats->closed[best_depth]++;
+    return true;
+  }
+};
+
+int lin_kernighan(Graph &g, int k, int max_depth, int breadth, LKStats *stats) {
+  return lin_kernighan(g, g.cycle, k, max_depth, breadth, stats);
+}
+
+// Variable depth search from every node with the don't-look bits queue of dlb_2opt.
+// Returns the number of improving moves.
+template <class Tour>
+int lin_kernighan(const Graph &g, Tour &cycle, int k, int max_depth, int breadth, LKStats *stats) {
+  ActiveQueue queue(g.n);
+  queue.push_all();
+  return lin_kernighan(g, cycle, k, max_depth, breadth, queue, stats);
+}
+
+template <class Tour>
+int lin_kernighan(const Graph &g, Tour &cycle, int k, int max_depth, int breadth, ActiveQueue &queue, LKStats *stats) {
+  LKSearch<Tour> lk(g, cycle, k, max_depth, breadth, stats);
+  int moves = 0;
+
+  while (!queue.empty()) {
+    if (lk.improve_from(queue.pop(), queue)) {
+      moves++;
+    }
+  }
+  return moves;
+}
+
+// Local search used by the metaheuristics, Lin-Kernighan takes its settings from ctx.
+// The deadline of ctx is checked between nodes, a search cut by it leaves the rest of
+// the queue. Returns the number of moves applied
+template <class Tour>
+int local_search(const Graph &g, Tour &cycle, int k, LocalSearch ls, const SolverContext &ctx) {
+  ActiveQueue queue(g.n);
+  queue.push_all();
+  return local_search(g, cycle, k, ls, queue, ctx);
+}
+
+template <class Tour>
+int local_search(const Graph &g, Tour &cycle, int k, LocalSearch ls, ActiveQueue &queue, const SolverContext &ctx) {
+  STATS_PHASE(PHASE_LOCAL_SEARCH);
+  LKSearch<Tour> lk(g, cycle, k, ctx.lk_depth, ctx.lk_breadth, ls == LIN_KERNIGHAN ? ctx.lk_stats : nullptr);
+  int moves = 0;
+
+  for (int popped=0; !queue.empty(); popped++) {
+    if (popped % DEADLINE_CHECK == 0 && ctx.done(INF)) break;
+    int a = queue.pop();
+    if (ls == LIN_KERNIGHAN ? lk.improve_from(a, queue) : two_opt_from(g, cycle, a, k, queue)) {
+      moves++;
+    }
+  }
+  return moves;
+}
+
+void local_search_2opt(Graph &g, int k, TourBackend backend) {
+  if (backend == ARRAY_LIST) {
+    dlb_2opt(g, g.cycle, k);
+    return;
+  }
+
+  TwoLevelList cycle;
+  cycle.build(g.cycle.tour);
+  cycle.len = g.cycle.len;
+  cycle.valid = g.cycle.valid;
+
+  dlb_2opt(g, cycle, k);
+
+  std::vector<int> tour;
+  cycle.get_tour(tour);
+  g.cycle.assign(tour, cycle.len);
+}
+
+template bool first_2opt(const Graph&, HamiltonianCycle&, int);
+template bool first_2opt(const Graph&, TwoLevelList&, int);
+template bool first_2opt(const Graph&, HamiltonianCycle&, int, TabuList&);
+template bool first_2opt(const Graph&, TwoLevelList&, int, TabuList&);
+template void best_2opt(const Graph&, HamiltonianCycle&, TabuList&);
+template void best_2opt(const Graph&, TwoLevelList&, TabuList&);
+template Move best_2opt_move(const Graph&, HamiltonianCycle&, TabuList&, TwoOptKernel);
+template Move best_2opt_move(const Graph&, TwoLevelList&, TabuList&, TwoOptKernel);
+template Move best_2opt_scan(const Graph&, HamiltonianCycle&, TabuList&);
+template Move best_2opt_scan(const Graph&, TwoLevelList&, TabuList&);
+template bool first_3opt(const Graph&, HamiltonianCycle&);
+template bool first_3opt(const Graph&, TwoLevelList&);
+template int dlb_2opt(const Graph&, HamiltonianCycle&, int);
+template int dlb_2opt(const Graph&, TwoLevelList&, int);
+template int dlb_2opt(const Graph&, HamiltonianCycle&, int, ActiveQueue&);
+template int dlb_2opt(const Graph&, TwoLevelList&, int, ActiveQueue&);
+template bool first_or_opt(const Graph&, HamiltonianCycle&, int);
+template bool first_or_opt(const Graph&, TwoLevelList&, int);
+template int lin_kernighan(const Graph&, HamiltonianCycle&, int, int, int, LKStats*);
+template int lin_kernighan(const Graph&, TwoLevelList&, int, int, int, LKStats*);
+template int lin_kernighan(const Graph&, HamiltonianCycle&, int, int, int, ActiveQueue&, LKStats*);
+template int lin_kernighan(const Graph&, TwoLevelList&, int, int, int, ActiveQueue&, LKStats*);
+template void TwoOptMove::apply(const Graph&, HamiltonianCycle&) const;
+template void TwoOptMove::apply(const Graph&, TwoLevelList&) const;
+template void ThreeOptMove::apply(const Graph&, HamiltonianCycle&) const;
+template void ThreeOptMove::apply(const Graph&, TwoLevelList&) const;
+template void OrOptMove::apply(const Graph&, HamiltonianCycle&) const;
+template void OrOptMove::apply(const Graph&, TwoLevelList&) const;
+template void check_tour(const Graph&, HamiltonianCycle&, const char*);
+template void check_tour(const Graph&, TwoLevelList&, const char*);
+
 // Metaheuristics
-void tabu_search(Graph &g, int k, int max_itr) {
+// Descent both tabu searches start from: first_2opt recording the removed edges as
+// tabu, or Lin-Kernighan
+static void tabu_descent(Graph &g, int k, TabuList &tl, SolverContext &ctx, LocalSearch ls) {
+  if (ls == LIN_KERNIGHAN) {
+    ctx.moves += local_search(g, g.cycle, k, ls, ctx);
+  }
+  else {
+    while(!ctx.done(g.cycle.len) && first_2opt(g, k, tl)) ctx.moves++;
+  }
+}
+
+void tabu_search(Graph &g, int k, int max_itr, SolverContext &ctx, LocalSearch ls) {
   TabuList tl(g.n);
   std::vector<int> best_tour(g.n);
   double best_of = INF;
 
   tl.tabu_time = std::ceil(k/1.5);
 
-  // Fist we get to a local optimal using best_2opt
-  while(first_2opt(g, k, tl));
+  // Fist we get to a local optimal using first_2opt (or Lin-Kernighan)
+  tabu_descent(g, k, tl, ctx, ls);
   best_tour = g.cycle.tour;
   best_of = g.cycle.len;
+  ctx.improved(best_tour, best_of);
 
   // Try to find a better solution using tabu serach
-  for (int itr=0; itr<max_itr; itr++) {
+  for (int itr=0; itr<max_itr && !ctx.done(best_of); itr++) {
     best_2opt(g, tl);
+    ctx.iterations++;
+    ctx.moves++;
     if (g.cycle.len < best_of) {
       best_tour = g.cycle.tour;
       best_of = g.cycle.len;
+      ctx.improved(best_tour, best_of);
+    }
+  }
+
+  g.cycle.assign(best_tour, best_of);
+  CHECK_TOUR(g, g.cycle, "tabu_search");
+}
+
+// Tabu search on the candidate lists. The best 2-opt move of each node (over its k
+// candidates, both directions) is cached in a max-heap. After a move the nodes whose
+// candidate moves may have changed are evaluated again: the endpoints of the changed
+// edges and the nodes with one of them as candidate, and the moves whose orientation
+// changed, between a node of the reversed side and a node out of it. Both ends of an
+// expired tabu edge and their tour neighbors are evaluated again too. The top of the
+// heap is checked again before being applied, and the heap is rebuilt from a full scan
+// when it runs out.
+namespace {
+struct CandidateMove {
+  double gain;
+  int a, c;
+  bool forward;
+  int version;
+  bool operator<(const CandidateMove &other) const { return gain < other.gain; }
+};
+}
+
+static CandidateMove best_candidate_move(const Graph &g, HamiltonianCycle &cycle, int a, int k, TabuList &tl) {
+  CandidateMove best;
+  int b, c, d;
+
+  best.gain = -INF;
+  best.a = a;
+  best.c = -1;
+  for (bool forward : {true, false}) {
+    b = forward ? cycle.next(a) : cycle.prev(a);
+
+    int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+    for (int idx=1; idx<=k_max; idx++) {
+      c = g.sorted_neighbor[a][idx];
+      d = forward ? cycle.next(c) : cycle.prev(c);
+      if (b == c || d == a) continue;
+      if (tl.is_tabu(a, c) || tl.is_tabu(b, d)) continue;
+
+      double gain = g.dist(a, b) + g.dist(c, d) - g.dist(a, c) - g.dist(b, d);
+      STATS_INC(evaluated);
+      if (gain > best.gain) {
+        best.gain = gain;
+        best.c = c;
+        best.forward = forward;
+      }
     }
   }
+  return best;
+}
 
-  g.cycle.tour = best_tour;
-  g.cycle.len = best_of;
+// Pushes the current best move of each node, nodes already evaluated at this stamp
+// are skipped
+static void refresh_moves(const Graph &g, HamiltonianCycle &cycle, const std::vector<int> &nodes, int k,
+                          TabuList &tl, std::vector<int> &version, std::vector<int> &seen, int stamp,
+                          std::priority_queue<CandidateMove> &heap) {
+  for (int node : nodes) {
+    if (seen[node] == stamp) continue;
+    seen[node] = stamp;
+    CandidateMove updated = best_candidate_move(g, cycle, node, k, tl);
+    updated.version = ++version[node];
+    if (updated.c != -1) heap.push(updated);
+  }
 }
 
-void grasp(Graph &g, int max_itr) {
+void tabu_search_incremental(Graph &g, int k, int max_itr, SolverContext &ctx, LocalSearch ls) {
+  TabuList tl(g.n);
+  std::vector<int> best_tour;
+  std::vector<int> version(g.n, 0);
+  std::vector<int> seen(g.n, -1);
+  std::vector<int> in_side(g.n, -1);
+  std::vector<std::vector<int> > reverse_neighbor(g.n);
+  std::priority_queue<CandidateMove> heap;
+  std::deque<std::pair<int, Tuple> > expiring;   // (expiration, edge) in tabu order
+  std::vector<int> all(g.n);
+  std::vector<int> side;
+  std::vector<int> dirty;
+  int stamp = 0;
+  double best_of;
+
+  tl.tabu_time = std::ceil(k/1.5);
+
+  // Nodes having each node in their candidate list
+  for (int a=0; a<g.n; a++) {
+    int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+    for (int idx=1; idx<=k_max; idx++) {
+      reverse_neighbor[g.sorted_neighbor[a][idx]].push_back(a);
+    }
+    all[a] = a;
+  }
+
+  tabu_descent(g, k, tl, ctx, ls);
+  best_tour = g.cycle.tour;
+  best_of = g.cycle.len;
+  ctx.improved(best_tour, best_of);
+
+  // Edges made tabu by the descent
+  for (int u=0; u<g.n; u++) {
+    for (std::pair<int, int> &entry : tl.list[u]) {
+      if (u < entry.first && entry.second > tl.itr) {
+        expiring.push_back(std::make_pair(entry.second, Tuple{u, entry.first}));
+      }
+    }
+  }
+  std::sort(expiring.begin(), expiring.end());
+
+  refresh_moves(g, g.cycle, all, k, tl, version, seen, stamp++, heap);
+
+  for (int itr=0; itr<max_itr && !ctx.done(best_of); itr++) {
+    CandidateMove move;
+    bool found = false;
+
+    // Moves adding an edge that is no longer tabu
+    dirty.clear();
+    while (!expiring.empty() && expiring.front().first <= tl.itr) {
+      for (int node : expiring.front().second) {
+        dirty.push_back(node);
+        dirty.push_back(g.cycle.next(node));
+        dirty.push_back(g.cycle.prev(node));
+      }
+      expiring.pop_front();
+    }
+    refresh_moves(g, g.cycle, dirty, k, tl, version, seen, stamp++, heap);
+
+    // Entries are checked again since the tabu list only lowers gains after they were
+    // cached. Once the heap is empty a full scan looks for moves left out.
+    for (int scan=0; scan<2 && !found; scan++) {
+      if (scan == 1) {
+        refresh_moves(g, g.cycle, all, k, tl, version, seen, stamp++, heap);
+      }
+      while (!heap.empty()) {
+        move = heap.top();
+        heap.pop();
+        if (move.version != version[move.a]) continue;
+
+        CandidateMove current = best_candidate_move(g, g.cycle, move.a, k, tl);
+        current.version = ++version[move.a];
+        if (current.c == -1) continue;
+        if (current.gain == move.gain) {
+          move = current;
+          found = true;
+          break;
+        }
+        heap.push(current);
+      }
+    }
+    if (!found) break;
+
+#ifdef TSP_DEBUG
+    for (int node=0; node<g.n; node++) {
+      if (best_candidate_move(g, g.cycle, node, k, tl).gain > move.gain) {
+        std::cout << "Solver - tabu_search_incremental:" << std::endl;
+        std::cout << "Heap move differs from the full scan" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+    }
+#endif
+
+    int a = move.a, c = move.c;
+    int b = move.forward ? g.cycle.next(a) : g.cycle.prev(a);
+    int d = move.forward ? g.cycle.next(c) : g.cycle.prev(c);
+
+    // The side from b to c (in tour order) or the one from d to a is reversed, both
+    // are equivalent here since the moves are evaluated in both directions
+    int first = move.forward ? b : c;
+    int last = move.forward ? c : b;
+    int len = (g.cycle.positions[last] - g.cycle.positions[first] + g.n) % g.n + 1;
+    if (2 * len > g.n) {
+      first = move.forward ? d : a;
+      last = move.forward ? a : d;
+    }
+    side.clear();
+    for (int node=first; ; node=g.cycle.next(node)) {
+      side.push_back(node);
+      if (node == last) break;
+    }
+
+    TwoOptMove two_opt = {a, b, c, d};
+    two_opt.apply(g, g.cycle);
+    STATS_INC(applied);
+    ctx.iterations++;
+    ctx.moves++;
+    int expiration = tl.itr + tl.tabu_time;
+    if (g.dist(a, b) < g.dist(c, d)) {
+      tl.add(a, b);
+      expiring.push_back(std::make_pair(expiration, Tuple{a, b}));
+    }
+    else {
+      tl.add(c, d);
+      expiring.push_back(std::make_pair(expiration, Tuple{c, d}));
+    }
+
+    if (g.cycle.len < best_of) {
+      best_tour = g.cycle.tour;
+      best_of = g.cycle.len;
+      ctx.improved(best_tour, best_of);
+    }
+
+    // Moves using a changed edge: the endpoints and the nodes with one of them as
+    // candidate. Moves between two nodes of the reversed side are the same moves in
+    // the other direction, only those crossing its border changed
+    dirty.clear();
+    for (int node : {a, b, c, d}) {
+      dirty.push_back(node);
+      dirty.insert(dirty.end(), reverse_neighbor[node].begin(), reverse_neighbor[node].end());
+    }
+    for (int node : side) {
+      in_side[node] = itr;
+    }
+    int k_max = std::min(k, g.sorted_neighbor.width() - 1);
+    for (int node : side) {
+      for (int idx=1; idx<=k_max; idx++) {
+        if (in_side[g.sorted_neighbor[node][idx]] != itr) {
+          dirty.push_back(node);
+          break;
+        }
+      }
+      for (int other : reverse_neighbor[node]) {
+        if (in_side[other] != itr) dirty.push_back(other);
+      }
+    }
+    refresh_moves(g, g.cycle, dirty, k, tl, version, seen, stamp++, heap);
+  }
+
+  g.cycle.assign(best_tour, best_of);
+  CHECK_TOUR(g, g.cycle, "tabu_search");
+}
+
+// Tour wrapper recording the flips so a rejected ILS iteration can be undone
+template <class Tour>
+struct FlipLog {
+  Tour &cycle;
+  double len;
+  bool valid;
+  std::vector<std::array<int, 4> > flips;
+
+  FlipLog(Tour &cycle): cycle(cycle), len(cycle.len), valid(cycle.valid) { }
+  int next(int id) { return cycle.next(id); }
+  int prev(int id) { return cycle.prev(id); }
+  bool between(int a, int b, int c) { return cycle.between(a, b, c); }
+
+  void flip(int a, int b, int c, int d) {
+    cycle.flip(a, b, c, d);
+    flips.push_back({a, b, c, d});
+  }
+
+  void rollback() {
+    while (!flips.empty()) {
+      std::array<int, 4> &f = flips.back();
+      cycle.flip(f[0], f[3], f[2], f[1]);
+      flips.pop_back();
+    }
+  }
+};
+
+// Double bridge A B C D -> A C B D where B and C are short segments after a random node.
+// The endpoints of the changed edges are queued for the local search.
+template <class Tour>
+void double_bridge(const Graph &g, Tour &cycle, Rng &rng, ActiveQueue &queue) {
+  int max_len = std::max(1, std::min(ILS_SEGMENT, (g.n - 2) / 3));
+  int a, b1, b2, c1, c2, d;
+
+  a = rng.uniform(g.n);
+  b1 = b2 = cycle.next(a);
+  for (int i=rng.uniform(1, max_len); i>1; i--) b2 = cycle.next(b2);
+  c1 = c2 = cycle.next(b2);
+  for (int i=rng.uniform(1, max_len); i>1; i--) c2 = cycle.next(c2);
+  d = cycle.next(c2);
+
+  cycle.len += g.dist(a, c1) + g.dist(c2, b1) + g.dist(b2, d)
+             - g.dist(a, b1) - g.dist(b2, c1) - g.dist(c2, d);
+
+  // a->b1..b2->c1..c2->d  =>  a->c2..c1->b2..b1->d  =>  a->c1..c2->b2..b1->d  =>  a->c1..c2->b1..b2->d
+  cycle.flip(a, b1, d, c2);
+  cycle.flip(a, c2, b2, c1);
+  cycle.flip(c2, b2, d, b1);
+  CHECK_TOUR(g, cycle, "double_bridge");
+
+  for (int node : {a, b1, b2, c1, c2, d}) {
+    queue.push(node);
+  }
+}
+
+void iterated_local_search(Graph &g, int max_itr, double epsilon, SolverContext &ctx, LocalSearch ls) {
+  iterated_local_search(g, g.cycle, max_itr, epsilon, ctx, ls);
+}
+
+void iterated_local_search(const Graph &g, HamiltonianCycle &cycle, int max_itr, double epsilon, SolverContext &ctx, LocalSearch ls) {
+  ActiveQueue queue(g.n);
+  std::vector<int> best_tour;
+  double best_of, current_of;
+
+  if (g.n < 8) {
+    std::cout << "Solver - iterated_local_search: " << std::endl;
+    std::cout << "Instance too small for a double bridge" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Initial local optimum, from nearest neighbor if there is no solution
+  if (!cycle.valid) {
+    randomize_nearest_neighbor(g, cycle, 0, ctx);
+  }
+  queue.push_all();
+  ctx.moves += local_search(g, cycle, 20, ls, queue, ctx);
+  best_tour = cycle.tour;
+  best_of = current_of = cycle.len;
+  ctx.improved(cycle.tour, best_of);
+
+  for (int itr=0; itr<max_itr && !ctx.done(best_of); itr++) {
+    FlipLog<HamiltonianCycle> log(cycle);
+
+    // Only the nodes around the kicked edges are optimized again
+    double_bridge(g, log, ctx.rng, queue);
+    ctx.moves += local_search(g, log, 20, ls, queue, ctx);
+    ctx.iterations++;
+
+    // Accepting better solutions, or within epsilon of the best one
+    if (log.len < current_of || log.len < best_of * (1 + epsilon)) {
+      current_of = cycle.len = log.len;
+      if (current_of < best_of) {
+        best_of = current_of;
+        if (epsilon > 0) best_tour = cycle.tour;
+        ctx.improved(cycle.tour, best_of);
+      }
+    }
+    else {
+      log.rollback();
+    }
+  }
+
+  // With epsilon = 0 the current solution is always the best one
+  if (epsilon > 0) {
+    cycle.assign(best_tour, best_of);
+  }
+  CHECK_TOUR(g, cycle, "iterated_local_search");
+}
+
+// Reactive GRASP: update alpha probabilities from the mean solution of each alpha. An
+// alpha not picked since the last update keeps its probability, the others share the rest
+static void update_alpha_probs(std::vector<double> &probs, std::vector<double> &mean, std::vector<int> &count, double best_len) {
+  double sum = 0, rest = 1;
+
+  for (int j=0; j<4; j++) {
+    if (count[j] > 0) {
+      mean[j] = pow(best_len/(mean[j]/count[j]), 2);
+      sum += mean[j];
+    }
+    else {
+      rest -= probs[j];
+    }
+  }
+
+  for (int j=0; j<4 && sum > 0; j++) {
+    if (count[j] > 0) probs[j] = rest * mean[j]/sum;
+  }
+
+  std::fill(mean.begin(), mean.end(), 0);
+  std::fill(count.begin(), count.end(), 0);
+}
+
+// Alpha index drawn with the given probabilities, discrete_distribution would allocate
+static int pick_alpha(const std::vector<double> &probs, Rng &rng) {
+  double r = rng.real();
+  int last = probs.size() - 1;
+  for (int j=0; j<last; j++) {
+    r -= probs[j];
+    if (r < 0) return j;
+  }
+  return last;
+}
+
+// The best tour is swapped with the current cycle instead of copied, the next
+// construction overwrites the whole cycle anyway
+void grasp(Graph &g, int max_itr, SolverContext &ctx, LocalSearch ls) {
+  grasp(g, g.cycle, max_itr, ctx, ls);
+}
+
+void grasp(const Graph &g, HamiltonianCycle &cycle, int max_itr, SolverContext &ctx, LocalSearch ls) {
   HamiltonianCycle best_tour;
   best_tour.resize(g.n);
   best_tour.len = INF;
@@ -477,48 +1837,168 @@ void grasp(Graph &g, int max_itr) {
   std::vector<double> mean(4, 0);
   std::vector<int> count(4, 0);
 
-  unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine generator (seed);
-
   int idx;
+  ctx.ws.reserve(g.n);
   for (int i=1; i<=max_itr; i++) {
-    std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    idx = dist(generator);
+    idx = pick_alpha(probs, ctx.rng);
     a = a_vec[idx];
 
-    randomize_nearest_neighbor(g, a);
-    while(first_2opt(g, 20));
+    randomize_nearest_neighbor(g, cycle, a, ctx);
+    ctx.ws.queue.push_all();
+    ctx.moves += local_search(g, cycle, 20, ls, ctx.ws.queue, ctx);
+    ctx.iterations++;
 
-    mean[idx] += g.cycle.len;
+    mean[idx] += cycle.len;
     count[idx]++;
 
-    if (g.cycle.len < best_tour.len) {
-      best_tour.len = g.cycle.len;
-      best_tour.tour = g.cycle.tour;
+    if (cycle.len < best_tour.len) {
+      std::swap(best_tour, cycle);
+      ctx.improved(best_tour.tour, best_tour.len);
     }
 
     if (i % 1000 == 0 ) {
-      double sum = 0;
+      update_alpha_probs(probs, mean, count, best_tour.len);
+    }
 
-      for (int j=0; j<4; j++) {
-        mean[j] = pow(best_tour.len/(mean[j]/count[j]), 2);
-        sum += mean[j];
+    // Checked after the iteration, so there is always a tour to return
+    if (ctx.done(best_tour.len)) break;
+
+  }
+
+  std::swap(best_tour, cycle);
+  CHECK_TOUR(g, cycle, "grasp");
+}
+
+// Best length over the workers of parallel_grasp, each new one is reported right away
+struct SharedBest {
+  std::mutex mutex;
+  std::atomic<double> len;
+};
+
+// Per-thread state of parallel_grasp. Only the graph and the shared best are shared
+// between workers.
+struct GraspWorker {
+  HamiltonianCycle cycle;
+  HamiltonianCycle best_tour;
+  SolverContext ctx;
+  SolverStats stats;
+  LKStats lk_stats;
+  std::vector<double> mean;
+  std::vector<int> count;
+  LocalSearch ls;
+  SharedBest *shared;
+};
+
+static void grasp_worker(const Graph &g, GraspWorker &w, const std::vector<double> &probs, int n_itr) {
+  float a_vec[4] = {0.1, 0.3, 0.5, 0.8};
+  int idx;
+
+  w.ctx.ws.reserve(g.n);
+  for (int i=0; i<n_itr; i++) {
+    idx = pick_alpha(probs, w.ctx.rng);
+
+    randomize_nearest_neighbor(g, w.cycle, a_vec[idx], w.ctx);
+    w.ctx.ws.queue.push_all();
+    w.ctx.moves += local_search(g, w.cycle, 20, w.ls, w.ctx.ws.queue, w.ctx);
+    w.ctx.iterations++;
+
+    w.mean[idx] += w.cycle.len;
+    w.count[idx]++;
+
+    if (w.cycle.len < w.best_tour.len) {
+      std::swap(w.best_tour, w.cycle);
+      std::lock_guard<std::mutex> lock(w.shared->mutex);
+      if (w.best_tour.len < w.shared->len) {
+        w.shared->len = w.best_tour.len;
+        w.ctx.improved(w.best_tour.tour, w.best_tour.len);
       }
+    }
+
+    // Stops at the deadline, or once any worker reaches the target
+    if (w.ctx.done(w.shared->len)) break;
+  }
+  STATS_SAVE(w.stats);
+}
+
+void parallel_grasp(Graph &g, int max_itr, int n_threads, SolverContext &ctx, LocalSearch ls) {
+  const int update_itr = 1000;
+  std::vector<double> probs(4, 1.0/4);
+  std::vector<double> mean(4, 0);
+  std::vector<int> count(4, 0);
+  std::vector<GraspWorker> workers(n_threads);
+  std::vector<std::thread> threads;
+  SharedBest shared;
+  int best = 0;
+
+  shared.len = INF;
+
+  if (n_threads < 1) {
+    std::cout << "Solver - parallel_grasp: " << std::endl;
+    std::cout << "Invalid number of threads: " << n_threads << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Each worker owns its cycle, random sub-stream and alpha statistics
+  for (int t=0; t<n_threads; t++) {
+    workers[t].ctx = ctx.stream(t);
+    workers[t].ctx.iterations = workers[t].ctx.moves = 0;
+    workers[t].stats.clear();
+    workers[t].cycle.resize(g.n);
+    workers[t].best_tour.resize(g.n);
+    workers[t].best_tour.len = INF;
+    workers[t].mean.assign(4, 0);
+    workers[t].count.assign(4, 0);
+    workers[t].ls = ls;
+    workers[t].shared = &shared;
+    if (ctx.lk_stats != nullptr) {
+      workers[t].ctx.lk_stats = &workers[t].lk_stats;
+    }
+  }
+
+  // Iterations are split in blocks of update_itr, workers are merged at the end of each block
+  for (int done=0; done<max_itr; done+=update_itr) {
+    int block = std::min(update_itr, max_itr - done);
+
+    threads.clear();
+    for (int t=0; t<n_threads; t++) {
+      int n_itr = block/n_threads + (t < block % n_threads ? 1 : 0);
+      threads.emplace_back(grasp_worker, std::cref(g), std::ref(workers[t]), std::cref(probs), n_itr);
+    }
+    for (std::thread &th : threads) {
+      th.join();
+    }
 
+    // Merging best tours and alpha statistics in thread order, so results only depend on the seed
+    for (int t=0; t<n_threads; t++) {
+      if (workers[t].best_tour.len < workers[best].best_tour.len) {
+        best = t;
+      }
       for (int j=0; j<4; j++) {
-        probs[j] = mean[j]/sum;
+        mean[j] += workers[t].mean[j];
+        count[j] += workers[t].count[j];
+      }
+      std::fill(workers[t].mean.begin(), workers[t].mean.end(), 0);
+      std::fill(workers[t].count.begin(), workers[t].count.end(), 0);
+      ctx.iterations += workers[t].ctx.iterations;
+      ctx.moves += workers[t].ctx.moves;
+      workers[t].ctx.iterations = workers[t].ctx.moves = 0;
+      STATS_MERGE(workers[t].stats);
+      workers[t].stats.clear();
+      if (ctx.lk_stats != nullptr) {
+        ctx.lk_stats->merge(workers[t].lk_stats);
+        workers[t].lk_stats.clear();
       }
-
-      std::fill(mean.begin(), mean.end(), 0);
-      std::fill(count.begin(), count.end(), 0);
     }
 
+    // A block cut by the deadline has incomplete statistics
+    if (ctx.done(workers[best].best_tour.len)) break;
+    if (block == update_itr) {
+      update_alpha_probs(probs, mean, count, workers[best].best_tour.len);
+    }
   }
 
-  g.cycle.len = best_tour.len;
-  for (int i=0; i<g.n; i++) {
-    g.cycle.add(best_tour.tour[i], i);
-  }
+  g.cycle.assign(workers[best].best_tour.tour, workers[best].best_tour.len);
+  CHECK_TOUR(g, g.cycle, "parallel_grasp");
 }
 
 // void Solver::build_sol_CW(int start) {
@@ -2,7 +2,13 @@
 #define SOLVER_H
 
 #include "Graph.h"
+#include "TwoLevelList.h"
+#include "KdTree.h"
 #include <limits>
+#include <random>
+#include <chrono>
+#include <functional>
+#include "Rng.h"
 
 
 const double INF = std::numeric_limits<double>::infinity();
@@ -13,47 +19,166 @@ struct Edge {
   double w;
 };
 
-struct Node {
-  int id;
-  int rank;
-  Node *parent;
-};
-Node* find(Node*);
-void merge(Node*, Node*);
-
 struct DisjointSet {
-  std::vector<Node> nodes;
+  std::vector<int> parent;
+  std::vector<int> rank;
   DisjointSet(int);
+  int find(int);
+  bool merge(int, int);
 };
 
 struct TabuList {
-  int size;
-  int **list;
+  std::vector<std::vector<std::pair<int, int> > > list; // (neighbor, expiration) of each node
   int itr;
   int tabu_time;
   TabuList(int);
-  ~TabuList();
+  bool is_tabu(int, int);
+  void add(int, int);
+};
+
+// FIFO of nodes whose don't-look bit is off, each node at most once
+struct ActiveQueue {
+  std::vector<int> queue;
+  std::vector<bool> active;
+  int head, queued;
+  ActiveQueue(int);
+  void push(int);
+  void push_all();
+  int pop();
+  bool empty();
+};
+
+// Buffers reused by the iterations of a solver, so the constructive and local search
+// loops stop allocating once they are warm. Each SolverContext owns one.
+struct Workspace {
+  std::vector<char> visited;
+  std::vector<int> candidates;
+  std::vector<int> possibilities;
+  std::vector<std::pair<double, int> > nearest;
+  KdTree unvisited;
+  ActiveQueue queue;
+  Workspace();
+  void reserve(int);
 };
 
 struct Move {
-  int i, j;
+  int a, b, c, d;
   int u, v;
   double gain;
 };
 
+// Typed moves. delta() is the change of the tour length (negative when improving) from
+// at most six distances, apply() makes the flips and adds delta() to len, so the tour and
+// its length stay consistent. TSP_DEBUG builds check the tour after every apply().
+
+// 2-opt: removes (a, b) and (c, d), adds (a, c) and (b, d). b = next(a) and d = next(c),
+// or both prev
+struct TwoOptMove {
+  int a, b, c, d;
+  double delta(const Graph&) const;
+  template <class Tour> void apply(const Graph&, Tour&) const;
+};
+
+// 3-opt segment insertion: a->b..c->d..e->f becomes a->d..e->c..b->f (reversed) or
+// a->d..e->b..c->f, with b..c forward, d = next(c) and f = next(e)
+struct ThreeOptMove {
+  int a, b, c, d, e, f;
+  bool reversed;
+  double delta(const Graph&) const;
+  template <class Tour> void apply(const Graph&, Tour&) const;
+};
+
+// Or-opt: the short segment s1..s2 (forward, between p and nx) moves between e and
+// f = next(e), reversed when s2 follows e
+struct OrOptMove {
+  int p, s1, s2, nx, e, f;
+  bool reversed;
+  ThreeOptMove segment() const;
+  double delta(const Graph&) const;
+  template <class Tour> void apply(const Graph&, Tour&) const;
+};
+
+// Exits when the tour is not a cycle over all nodes, its positions are stale or len
+// differs from a full recompute. Called by the moves in TSP_DEBUG builds.
+template <class Tour> void check_tour(const Graph&, Tour&, const char*);
+
+struct LKStats {
+  std::vector<long long> tried;   // flips tried at each depth
+  std::vector<long long> closed;  // improving moves closed at each depth
+  void merge(const LKStats&);
+  void clear();
+};
+
+// State passed to the metaheuristics. The seeded generator makes runs depend only on
+// the seed, parallel workers draw from their own sub-stream, stream(t). A solver stops
+// at max_itr, at the deadline or once its best tour reaches target, whichever comes
+// first, and reports every new best tour to on_improve. The Lin-Kernighan local search
+// runs with lk_depth and lk_breadth and counts its flips in lk_stats when set; stream(t)
+// keeps the pointer, parallel solvers give each worker its own LKStats.
+struct SolverContext {
+  unsigned long long seed;
+  Rng rng;
+  std::chrono::steady_clock::time_point deadline;
+  double target;
+  std::function<void(const std::vector<int>&, double)> on_improve;
+  long long iterations;   // work done by the solvers, read by the benchmark
+  long long moves;
+  int lk_depth;
+  int lk_breadth;
+  LKStats *lk_stats;
+  Workspace ws;
+
+  SolverContext(unsigned long long = 0);
+  SolverContext stream(int) const;
+  void set_time_limit(double);
+  bool done(double) const;
+  void improved(const std::vector<int>&, double) const;
+};
+
+enum TourBackend { ARRAY_LIST, TWO_LEVEL_LIST };
+enum TwoOptKernel { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_AVX2 };
+enum LocalSearch { TWO_OPT, LIN_KERNIGHAN };
+
 //------------------> Solver Functions
 
 // Constructive
 void greedy_constructive_heuristic(Graph&);
-void randomize_nearest_neighbor(Graph&, float);
-// Local Search
+void greedy_constructive_heuristic(const Graph&, HamiltonianCycle&);
+void space_filling_curve(Graph&);
+void space_filling_curve(const Graph&, HamiltonianCycle&);
+void greedy_space_filling_curve(Graph&);
+void greedy_space_filling_curve(const Graph&, HamiltonianCycle&);
+void randomize_nearest_neighbor(Graph&, float, SolverContext&);
+void randomize_nearest_neighbor(const Graph&, HamiltonianCycle&, float, SolverContext&);
+// Local Search (Tour is HamiltonianCycle or TwoLevelList)
 void best_2opt(Graph&, TabuList&);
+template <class Tour> void best_2opt(const Graph&, Tour&, TabuList&);
+template <class Tour> Move best_2opt_move(const Graph&, Tour&, TabuList&, TwoOptKernel = KERNEL_AUTO);
+template <class Tour> Move best_2opt_scan(const Graph&, Tour&, TabuList&);
+bool two_opt_kernel_supported(TwoOptKernel);
 bool first_2opt(Graph&, int);
+template <class Tour> bool first_2opt(const Graph&, Tour&, int);
 bool first_2opt(Graph&, int, TabuList&);
+template <class Tour> bool first_2opt(const Graph&, Tour&, int, TabuList&);
 bool first_3opt(Graph&);
+template <class Tour> bool first_3opt(const Graph&, Tour&);
+bool first_or_opt(Graph&, int);
+template <class Tour> bool first_or_opt(const Graph&, Tour&, int);
+int dlb_2opt(Graph&, int);
+template <class Tour> int dlb_2opt(const Graph&, Tour&, int);
+template <class Tour> int dlb_2opt(const Graph&, Tour&, int, ActiveQueue&);
+int lin_kernighan(Graph&, int, int, int, LKStats* = nullptr);
+template <class Tour> int lin_kernighan(const Graph&, Tour&, int, int, int, LKStats* = nullptr);
+template <class Tour> int lin_kernighan(const Graph&, Tour&, int, int, int, ActiveQueue&, LKStats* = nullptr);
+void local_search_2opt(Graph&, int, TourBackend);
 // Metaheuristics
-void local_search_vnd(Graph&, int ,int);
-void tabu_search(Graph&, int, int);
-void grasp(Graph&, int);
+int local_search_vnd(Graph&, int, bool = true);
+void tabu_search(Graph&, int, int, SolverContext&, LocalSearch = TWO_OPT);
+void tabu_search_incremental(Graph&, int, int, SolverContext&, LocalSearch = TWO_OPT);
+void grasp(Graph&, int, SolverContext&, LocalSearch = TWO_OPT);
+void grasp(const Graph&, HamiltonianCycle&, int, SolverContext&, LocalSearch = TWO_OPT);
+void iterated_local_search(Graph&, int, double, SolverContext&, LocalSearch = TWO_OPT);
+void iterated_local_search(const Graph&, HamiltonianCycle&, int, double, SolverContext&, LocalSearch = TWO_OPT);
+void parallel_grasp(Graph&, int, int, SolverContext&, LocalSearch = TWO_OPT);
 
 #endif
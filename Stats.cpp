@@ -0,0 +1,31 @@
+#include "Stats.h"
+
+thread_local SolverStats tsp_stats = SolverStats();
+
+//    SolverStats
+void SolverStats::clear() {
+  *this = SolverStats();
+}
+
+void SolverStats::merge(const SolverStats &other) {
+  evaluated += other.evaluated;
+  applied += other.applied;
+  pruned += other.pruned;
+  reversals += other.reversals;
+  reversed += other.reversed;
+  for (int p=0; p<N_PHASES; p++) {
+    phase_ns[p] += other.phase_ns[p];
+  }
+}
+
+// One line per solve: name key=value ...
+void SolverStats::dump(const char *name, std::ostream &out) const {
+  out << "stats " << name
+      << " evaluated=" << evaluated
+      << " applied=" << applied
+      << " pruned=" << pruned
+      << " reversals=" << reversals
+      << " reversed=" << reversed
+      << " construct_ns=" << phase_ns[PHASE_CONSTRUCT]
+      << " local_search_ns=" << phase_ns[PHASE_LOCAL_SEARCH] << std::endl;
+}
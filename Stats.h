@@ -0,0 +1,61 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <iostream>
+
+//------------------> Instrumentation
+// Hot path counters, compiled in with -DTSP_STATS (make stats). Without it the
+// STATS_* macros expand to nothing. Counters are thread_local; parallel workers
+// hand theirs to the calling thread with STATS_SAVE and STATS_MERGE. Phases are
+// timed per solver call, the time of tour reversals is part of local_search.
+enum StatsPhase { PHASE_CONSTRUCT, PHASE_LOCAL_SEARCH, N_PHASES };
+
+struct SolverStats {
+  long long evaluated;            // candidate moves whose gain was computed
+  long long applied;              // moves applied to the tour
+  long long pruned;               // neighbor list scans cut by the gain bound
+  long long reversals;            // calls to reverse
+  long long reversed;             // nodes moved (segments in the two-level list)
+  long long phase_ns[N_PHASES];   // time of each phase, inner phases included
+
+  void clear();
+  void merge(const SolverStats&);
+  void dump(const char*, std::ostream&) const;
+};
+
+extern thread_local SolverStats tsp_stats;
+
+// Adds the time of its scope to a phase
+class PhaseTimer {
+public:
+  explicit PhaseTimer(StatsPhase phase): phase(phase), begin(std::chrono::steady_clock::now()) { }
+  ~PhaseTimer() {
+    tsp_stats.phase_ns[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - begin).count();
+  }
+
+private:
+  StatsPhase phase;
+  std::chrono::steady_clock::time_point begin;
+};
+
+#ifdef TSP_STATS
+#define STATS_INC(field) (tsp_stats.field++)
+#define STATS_ADD(field, value) (tsp_stats.field += (value))
+#define STATS_PHASE(phase) PhaseTimer stats_phase_timer(phase)
+#define STATS_RESET() tsp_stats.clear()
+#define STATS_DUMP(name) tsp_stats.dump(name, std::cerr)
+#define STATS_SAVE(stats) (stats).merge(tsp_stats)
+#define STATS_MERGE(stats) tsp_stats.merge(stats)
+#else
+#define STATS_INC(field) ((void)0)
+#define STATS_ADD(field, value) ((void)0)
+#define STATS_PHASE(phase) ((void)0)
+#define STATS_RESET() ((void)0)
+#define STATS_DUMP(name) ((void)0)
+#define STATS_SAVE(stats) ((void)0)
+#define STATS_MERGE(stats) ((void)0)
+#endif
+
+#endif
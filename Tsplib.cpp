@@ -0,0 +1,261 @@
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Tsplib.h"
+
+//    Parsing helpers (the file is read through mmap, no iostreams)
+static bool is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char* skip_blank(const char *p, const char *end) {
+  while (p < end && is_blank(*p)) p++;
+  return p;
+}
+
+// Thrown by the parser, load_tsplib turns it into its error message
+struct TsplibError : std::runtime_error {
+  TsplibError(const std::string &msg): std::runtime_error(msg) { }
+};
+
+static void parse_error(const std::string &msg) {
+  throw TsplibError(msg);
+}
+
+// Decimal number with optional sign, fraction and exponent
+static const char* parse_number(const char *p, const char *end, double &value) {
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  unsigned long long mantissa = 0;
+  int exponent = 0, digits = 0;
+  bool negative = false;
+
+  p = skip_blank(p, end);
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+  for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+    if (mantissa < 1000000000000000000ULL) mantissa = mantissa*10 + (*p - '0');
+    else exponent++;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+      if (mantissa < 1000000000000000000ULL) {
+        mantissa = mantissa*10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (digits == 0) {
+    parse_error("Invalid number");
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    double e;
+    p = parse_number(p + 1, end, e);
+    exponent += static_cast<int>(e);
+  }
+
+  value = static_cast<double>(mantissa);
+  while (exponent > 0) {
+    int step = exponent > 22 ? 22 : exponent;
+    value *= pow10[step];
+    exponent -= step;
+  }
+  while (exponent < 0) {
+    int step = -exponent > 22 ? 22 : -exponent;
+    value /= pow10[step];
+    exponent += step;
+  }
+  if (negative) value = -value;
+  return p;
+}
+
+// Value of a "KEY : VALUE" header line, trimmed
+static const char* parse_value(const char *p, const char *end, std::string &value) {
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  if (p < end && *p == ':') p++;
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+  const char *begin = p;
+  while (p < end && *p != '\n') p++;
+  const char *last = p;
+  while (last > begin && is_blank(*(last - 1))) last--;
+  value.assign(begin, last);
+  return p;
+}
+
+static const char* parse_weights(const char *p, const char *end, TsplibInstance &inst) {
+  const std::string &format = inst.edge_weight_format;
+  int n = inst.dimension;
+  double value;
+
+  inst.weights.assign(static_cast<long long>(n) * n, 0);
+  std::vector<int> &w = inst.weights;
+
+  // Column formats of a symmetric matrix read as the transposed row format
+  bool full = (format == "FULL_MATRIX");
+  bool upper = (format == "UPPER_ROW" || format == "LOWER_COL" ||
+                format == "UPPER_DIAG_ROW" || format == "LOWER_DIAG_COL");
+  bool lower = (format == "LOWER_ROW" || format == "UPPER_COL" ||
+                format == "LOWER_DIAG_ROW" || format == "UPPER_DIAG_COL");
+  bool diagonal = (format.find("DIAG") != std::string::npos);
+
+  if (!full && !upper && !lower) {
+    parse_error("Unsupported EDGE_WEIGHT_FORMAT: " + format);
+  }
+
+  for (int i=0; i<n; i++) {
+    int first = full ? 0 : (upper ? (diagonal ? i : i+1) : 0);
+    int last = full ? n-1 : (upper ? n-1 : (diagonal ? i : i-1));
+
+    for (int j=first; j<=last; j++) {
+      p = parse_number(p, end, value);
+      w[static_cast<long long>(i)*n + j] = static_cast<int>(value);
+      if (!full) {
+        w[static_cast<long long>(j)*n + i] = static_cast<int>(value);
+      }
+    }
+  }
+  return p;
+}
+
+static const char* parse_coords(const char *p, const char *end, std::vector<Point> &coords, int n) {
+  double id, x, y;
+
+  coords.resize(n);
+  for (int i=0; i<n; i++) {
+    p = parse_number(p, end, id);
+    p = parse_number(p, end, x);
+    p = parse_number(p, end, y);
+    coords[i].x = x;
+    coords[i].y = y;
+  }
+  return p;
+}
+
+//    TSPLIB reader. Header keywords may come in any order.
+static void parse_tsplib(const char *p, const char *end, TsplibInstance &inst) {
+  std::string key, value;
+
+  inst = TsplibInstance();
+  inst.dimension = 0;
+
+  while (true) {
+    p = skip_blank(p, end);
+    if (p >= end) break;
+
+    const char *begin = p;
+    while (p < end && !is_blank(*p) && *p != ':') p++;
+    key.assign(begin, p);
+
+    if (key == "EOF") {
+      break;
+    }
+    else if (key == "NODE_COORD_SECTION" || key == "DISPLAY_DATA_SECTION") {
+      if (inst.dimension <= 0) parse_error("Section before DIMENSION");
+      std::vector<Point> coords;
+      p = parse_coords(p, end, coords, inst.dimension);
+      // Display coordinates are only kept when there are no node coordinates
+      if (key == "NODE_COORD_SECTION" || inst.coords.empty()) {
+        inst.coords.swap(coords);
+      }
+    }
+    else if (key == "EDGE_WEIGHT_SECTION") {
+      if (inst.dimension <= 0) parse_error("Section before DIMENSION");
+      p = parse_weights(p, end, inst);
+    }
+    else {
+      p = parse_value(p, end, value);
+      if (key == "NAME") inst.name = value;
+      else if (key == "DIMENSION") inst.dimension = std::atoi(value.c_str());
+      else if (key == "EDGE_WEIGHT_TYPE") inst.edge_weight_type = value;
+      else if (key == "EDGE_WEIGHT_FORMAT") inst.edge_weight_format = value;
+      else if (key == "TYPE" && value != "TSP") parse_error("Unsupported TYPE: " + value);
+    }
+  }
+
+  if (inst.dimension <= 0) {
+    parse_error("Missing DIMENSION");
+  }
+  if (inst.edge_weight_type == "EXPLICIT" ? inst.weights.empty() : inst.coords.empty()) {
+    parse_error("Missing NODE_COORD_SECTION or EDGE_WEIGHT_SECTION");
+  }
+}
+
+// False with the reason in error when the file can not be read or does not parse
+bool load_tsplib(const char *f_name, TsplibInstance &inst, std::string &error) {
+  int fd = open(f_name, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    error = "Could not open the file";
+    return false;
+  }
+
+  size_t size = st.st_size;
+  void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+  if (data == MAP_FAILED) {
+    close(fd);
+    error = "Could not map the file";
+    return false;
+  }
+  if (data != nullptr) {
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+
+  bool loaded = true;
+  try {
+    const char *p = static_cast<const char*>(data);
+    parse_tsplib(p, p + size, inst);
+  }
+  catch (const TsplibError &e) {
+    error = e.what();
+    loaded = false;
+  }
+
+  if (data != nullptr) {
+    munmap(data, size);
+  }
+  close(fd);
+  return loaded;
+}
+
+void read_tsplib(const char *f_name, TsplibInstance &inst) {
+  std::string error;
+  if (!load_tsplib(f_name, inst, error)) {
+    std::cout << "Tsplib - read_tsplib:" << std::endl;
+    std::cout << error << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// Graph metric name of the EDGE_WEIGHT_TYPE, nullptr when unsupported
+static const char* metric_name(const std::string &type) {
+  if (type == "EUC_2D") return "euclid";
+  if (type == "ATT") return "pseudo_euclid";
+  if (type == "CEIL_2D") return "ceil_euclid";
+  if (type == "GEO") return "geo";
+  if (type == "EXPLICIT") return "explicit";
+  return nullptr;
+}
+
+bool tsplib_supported(const TsplibInstance &inst) {
+  return metric_name(inst.edge_weight_type) != nullptr;
+}
+
+const char* tsplib_metric(const TsplibInstance &inst) {
+  const std::string &type = inst.edge_weight_type;
+  const char *metric = metric_name(type);
+  if (metric != nullptr) return metric;
+
+  std::cout << "Tsplib - tsplib_metric:" << std::endl;
+  std::cout << "Unsupported EDGE_WEIGHT_TYPE: " << type << std::endl;
+  std::exit(EXIT_FAILURE);
+}
@@ -0,0 +1,23 @@
+#ifndef TSPLIB_H
+#define TSPLIB_H
+
+#include <string>
+#include <vector>
+#include "Graph.h"
+
+//------------------> TSPLIB instance
+struct TsplibInstance {
+  std::string name;
+  std::string edge_weight_type;   // EUC_2D, ATT, CEIL_2D, GEO or EXPLICIT
+  std::string edge_weight_format; // Layout of EDGE_WEIGHT_SECTION (EXPLICIT only)
+  int dimension;
+  std::vector<Point> coords;      // NODE_COORD_SECTION
+  std::vector<int> weights;       // Full n x n matrix (EXPLICIT only)
+};
+
+bool load_tsplib(const char*, TsplibInstance&, std::string&);
+void read_tsplib(const char*, TsplibInstance&);
+bool tsplib_supported(const TsplibInstance&);
+const char* tsplib_metric(const TsplibInstance&);
+
+#endif
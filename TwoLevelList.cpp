@@ -0,0 +1,190 @@
+#include <cmath>
+#include <algorithm>
+#include "TwoLevelList.h"
+#include "Stats.h"
+
+TwoLevelList::TwoLevelList(): len(0), valid(false), size(0), group_size(0), head(0), used(0) { }
+
+void TwoLevelList::build(const std::vector<int> &tour) {
+  size = tour.size();
+  group_size = std::max(8, static_cast<int>(std::sqrt(size)));
+  int n_segments = (size + group_size - 1) / group_size;
+
+  parent.resize(size);
+  idx.resize(size);
+  if (static_cast<int>(segments.size()) < n_segments) {
+    segments.resize(n_segments);
+  }
+  used = n_segments;
+
+  for (int s=0; s<n_segments; s++) {
+    Segment &seg = segments[s];
+    int begin = s*group_size;
+    int end = std::min(size, begin + group_size);
+
+    seg.nodes.assign(tour.begin() + begin, tour.begin() + end);
+    seg.reversed = false;
+    seg.rank = s;
+    seg.next = (s + 1) % n_segments;
+    seg.prev = (s - 1 + n_segments) % n_segments;
+
+    for (int i=0; i<end-begin; i++) {
+      parent[seg.nodes[i]] = s;
+      idx[seg.nodes[i]] = i;
+    }
+  }
+  head = 0;
+}
+
+void TwoLevelList::get_tour(std::vector<int> &tour) {
+  tour.resize(size);
+  int node = first(head);
+  for (int i=0; i<size; i++) {
+    tour[i] = node;
+    node = next(node);
+  }
+}
+
+int TwoLevelList::first(int s) {
+  return segments[s].reversed ? segments[s].nodes.back() : segments[s].nodes.front();
+}
+
+int TwoLevelList::last(int s) {
+  return segments[s].reversed ? segments[s].nodes.front() : segments[s].nodes.back();
+}
+
+int TwoLevelList::next(int id) {
+  const Segment &seg = segments[parent[id]];
+  int i = idx[id];
+
+  if (!seg.reversed) {
+    return (i + 1 < static_cast<int>(seg.nodes.size())) ? seg.nodes[i+1] : first(seg.next);
+  }
+  return (i > 0) ? seg.nodes[i-1] : first(seg.next);
+}
+
+int TwoLevelList::prev(int id) {
+  const Segment &seg = segments[parent[id]];
+  int i = idx[id];
+
+  if (!seg.reversed) {
+    return (i > 0) ? seg.nodes[i-1] : last(seg.prev);
+  }
+  return (i + 1 < static_cast<int>(seg.nodes.size())) ? seg.nodes[i+1] : last(seg.prev);
+}
+
+// Position of a node in the tour order starting at head (only used for comparisons)
+int TwoLevelList::seq(int id) {
+  const Segment &seg = segments[parent[id]];
+  int i = seg.reversed ? static_cast<int>(seg.nodes.size()) - 1 - idx[id] : idx[id];
+  return seg.rank * group_size + i;
+}
+
+bool TwoLevelList::between(int a, int b, int c) {
+  int sa = seq(a), sb = seq(b), sc = seq(c);
+
+  if (sc > sa) {
+    return (sb > sa && sb < sc);
+  }
+  else {
+    return (sb > sa || sb < sc);
+  }
+}
+
+// Makes id the first node of its segment
+void TwoLevelList::split(int id) {
+  int s = parent[id];
+  if (first(s) == id) return;
+
+  int t = used++;
+  if (t == static_cast<int>(segments.size())) {
+    segments.emplace_back();
+  }
+
+  // s keeps nodes[0, cut), t gets nodes[cut, end)
+  Segment &seg = segments[s];
+  Segment &new_seg = segments[t];
+  int cut = seg.reversed ? idx[id] + 1 : idx[id];
+
+  new_seg.nodes.assign(seg.nodes.begin() + cut, seg.nodes.end());
+  seg.nodes.resize(cut);
+  new_seg.reversed = seg.reversed;
+  for (int i=0; i<static_cast<int>(new_seg.nodes.size()); i++) {
+    parent[new_seg.nodes[i]] = t;
+    idx[new_seg.nodes[i]] = i;
+  }
+
+  // In tour order the suffix comes after s unless s is reversed
+  int before = seg.reversed ? seg.prev : s;
+  int after = segments[before].next;
+  new_seg.prev = before;
+  new_seg.next = after;
+  segments[before].next = t;
+  segments[after].prev = t;
+}
+
+// Reverses the tour path going forward from node start to node end
+void TwoLevelList::reverse(int start, int end) {
+  int after = next(end);
+  if (after == start) {
+    return;
+  }
+
+  split(start);
+  split(after);
+
+  int s1 = parent[start], s2 = parent[end];
+  int n_run = 1, n_segments = used;
+  for (int s=s1; s!=s2; s=segments[s].next) n_run++;
+
+  // Reversing the complementary path gives the same cycle
+  if (2*n_run > n_segments) {
+    int aux = segments[s2].next;
+    s2 = segments[s1].prev;
+    s1 = aux;
+  }
+
+  run.clear();
+  for (int s=s1; ; s=segments[s].next) {
+    run.push_back(s);
+    if (s == s2) break;
+  }
+  STATS_INC(reversals);
+  STATS_ADD(reversed, run.size());
+
+  int before = segments[s1].prev;
+  int behind = segments[s2].next;
+  for (int s : run) {
+    segments[s].reversed = !segments[s].reversed;
+    std::swap(segments[s].next, segments[s].prev);
+  }
+  segments[s2].prev = before;
+  segments[s1].next = behind;
+  segments[before].next = s2;
+  segments[behind].prev = s1;
+
+  // Too many small segments: rebuilding keeps the O(sqrt(n)) bound
+  if (n_segments > 2*((size + group_size - 1) / group_size) + 2) {
+    get_tour(buffer);
+    build(buffer);
+    return;
+  }
+  renumber();
+}
+
+void TwoLevelList::renumber() {
+  int rank = 0, s = head;
+  do {
+    segments[s].rank = rank++;
+    s = segments[s].next;
+  } while (s != head);
+}
+
+void TwoLevelList::flip(int a, int b, int c, int d) {
+  if (next(a) == b) {
+    reverse(b, d);
+  }
+  else {
+    reverse(a, c);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef TWO_LEVEL_LIST_H
+#define TWO_LEVEL_LIST_H
+
+#include <vector>
+
+//------------------> Class TwoLevelList
+// Tour stored as a ring of segments of about sqrt(n) nodes, each segment with
+// a reversed bit. next, prev and between are O(1), flip is O(sqrt(n)) amortized.
+// Same interface as HamiltonianCycle so the local searches work on both.
+class TwoLevelList {
+public:
+  double len;
+  bool valid;
+
+  TwoLevelList();
+  void build(const std::vector<int>&);
+  void get_tour(std::vector<int>&);
+  int next(int);
+  int prev(int);
+
+  bool between(int, int, int);
+  void flip(int, int, int, int);
+
+private:
+  struct Segment {
+    std::vector<int> nodes;
+    bool reversed;
+    int rank;
+    int next, prev;
+  };
+
+  int size;
+  int group_size;
+  int head;
+  int used;                  // segments in use, the rest are kept for reuse
+  std::vector<Segment> segments;
+  std::vector<int> parent;   // segment of each node
+  std::vector<int> idx;      // index of each node inside its segment
+  std::vector<int> run;      // buffer of segments reversed by a flip
+  std::vector<int> buffer;   // buffer of nodes for rebuilding
+
+  int first(int);
+  int last(int);
+  int seq(int);
+  void split(int);
+  void reverse(int, int);
+  void renumber();
+};
+
+#endif
@@ -0,0 +1,388 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <algorithm>
+#include "Graph.h"
+#include "Tsplib.h"
+#include "Solver.h"
+
+// Batch solve service: one process solves a stream of jobs on a pool of worker threads.
+// Jobs come from stdin, or from the *.job files dropped in a spool directory, one per
+// line (blank lines and lines starting with # are skipped):
+//
+//   <instance> [solver] [seconds] [seed] [dense|sparse]
+//
+// solvers: greedy sfc sfc_greedy nn grasp ils (default grasp, 1 second, seed 0, dense).
+// Instance graphs are built once and cached, jobs share them read-only and solve on
+// their own cycle. One line per job goes to stdout as soon as it is finished:
+//
+//   <id> ok <instance> <solver> <seed> <length> <build_s> <solve_s> <iterations> <tour ...>
+//   <id> error <instance> <message>
+//
+// In spool mode job files should be renamed into the directory once written, they are
+// deleted once read. The service stops when a file named "stop" shows up and the queued
+// jobs are done.
+//
+// usage: ./batch [threads] [cache_size] [spool_dir]
+
+const int NEIGHBORS = 20;
+const int GRASP_ITR = 1000;    // iterations of grasp and ils when the job has no time budget
+const int SPOOL_POLL_MS = 200;
+
+struct Job {
+  int id;
+  std::string instance;
+  std::string solver;
+  double seconds;
+  unsigned long long seed;
+  bool sparse;
+};
+
+// False when the line does not parse, job.instance is then the whole line
+bool parse_job(const std::string &line, int id, Job &job) {
+  std::istringstream in(line);
+  std::vector<std::string> fields;
+  std::string field;
+  while (in >> field) {
+    fields.push_back(field);
+  }
+
+  char *end;
+  job.id = id;
+  job.instance = line;
+  if (fields.empty() || fields.size() > 5) return false;
+  job.instance = fields[0];
+  job.solver = (fields.size() > 1) ? fields[1] : "grasp";
+  job.seconds = 1;
+  job.seed = 0;
+  job.sparse = false;
+  if (fields.size() > 2) {
+    job.seconds = std::strtod(fields[2].c_str(), &end);
+    if (*end != '\0') return false;
+  }
+  if (fields.size() > 3) {
+    job.seed = std::strtoull(fields[3].c_str(), &end, 10);
+    if (*end != '\0') return false;
+  }
+  if (fields.size() > 4) {
+    if (fields[4] != "dense" && fields[4] != "sparse") return false;
+    job.sparse = (fields[4] == "sparse");
+  }
+  return true;
+}
+
+//    JobQueue
+class JobQueue {
+public:
+  JobQueue(): closed(false) { }
+
+  void push(const Job &job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(job);
+    ready.notify_one();
+  }
+
+  // No more jobs, the workers leave once the queue is empty
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    ready.notify_all();
+  }
+
+  bool pop(Job &job) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this]() {return closed || !jobs.empty();});
+    if (jobs.empty()) return false;
+    job = jobs.front();
+    jobs.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Job> jobs;
+  bool closed;
+};
+
+//    GraphCache
+// Graphs by (instance, mode). Each one is built by the first job asking for it while the
+// others wait on its once_flag, past capacity the least recently used one is dropped
+// (jobs still solving on it keep their reference).
+class GraphCache {
+public:
+  GraphCache(int capacity): capacity(std::max(1, capacity)), tick(0) { }
+
+  // nullptr with the reason in error when the instance can not be built, failed entries
+  // leave the cache so a fixed file is read again
+  std::shared_ptr<const Graph> get(const Job &job, bool &hit, std::string &error) {
+    std::string key = job.instance + (job.sparse ? " sparse" : " dense");
+    std::shared_ptr<Entry> entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::map<std::string, std::shared_ptr<Entry> >::iterator it = entries.find(key);
+      hit = (it != entries.end());
+      if (hit) {
+        entry = it->second;
+      }
+      else {
+        if (static_cast<int>(entries.size()) >= capacity) {
+          evict();
+        }
+        entry = std::make_shared<Entry>();
+        entries[key] = entry;
+      }
+      entry->used = ++tick;
+    }
+
+    std::call_once(entry->built, [&]() {
+      entry->graph = build(job, entry->error);
+    });
+
+    if (entry->graph == nullptr) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::map<std::string, std::shared_ptr<Entry> >::iterator it = entries.find(key);
+      if (it != entries.end() && it->second == entry) {
+        entries.erase(it);
+      }
+      error = entry->error;
+    }
+    return entry->graph;
+  }
+
+private:
+  struct Entry {
+    std::once_flag built;
+    std::shared_ptr<const Graph> graph;
+    std::string error;
+    long long used;
+  };
+
+  int capacity;
+  long long tick;
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<Entry> > entries;
+
+  // Checks what Graph::build would exit on, so a bad job does not stop the service
+  static std::shared_ptr<const Graph> build(const Job &job, std::string &error) {
+    TsplibInstance inst;
+    if (!load_tsplib(job.instance.c_str(), inst, error)) {
+      return nullptr;
+    }
+    if (!tsplib_supported(inst)) {
+      error = "Unsupported EDGE_WEIGHT_TYPE: " + inst.edge_weight_type;
+      return nullptr;
+    }
+    if (job.sparse && (inst.coords.empty() || std::strcmp(tsplib_metric(inst), "explicit") == 0)) {
+      error = "Sparse mode requires node coordinates";
+      return nullptr;
+    }
+
+    std::shared_ptr<Graph> graph = std::make_shared<Graph>();
+    if (job.sparse) {
+      graph->build_sparse(inst, NEIGHBORS);
+    }
+    else {
+      graph->build(inst, "auto", NEIGHBORS);
+    }
+    return graph;
+  }
+
+  void evict() {
+    std::map<std::string, std::shared_ptr<Entry> >::iterator lru = entries.begin();
+    for (std::map<std::string, std::shared_ptr<Entry> >::iterator it = entries.begin(); it != entries.end(); it++) {
+      if (it->second->used < lru->second->used) lru = it;
+    }
+    entries.erase(lru);
+  }
+};
+
+//    Output
+std::mutex output_mutex;
+
+void write_error(const Job &job, const std::string &message) {
+  std::lock_guard<std::mutex> lock(output_mutex);
+  std::cout << job.id << " error " << job.instance << " " << message << std::endl;
+}
+
+void write_result(const Job &job, const HamiltonianCycle &cycle, double build_time, double solve_time,
+                  long long iterations) {
+  std::ostringstream line;
+  line << job.id << " ok " << job.instance << " " << job.solver << " " << job.seed << " "
+       << std::fixed << std::setprecision(0) << cycle.len << " " << std::setprecision(6) << build_time
+       << " " << solve_time << " " << iterations;
+  for (int node : cycle.tour) {
+    line << " " << node;
+  }
+
+  std::lock_guard<std::mutex> lock(output_mutex);
+  std::cout << line.str() << std::endl;
+}
+
+//    Workers
+// False for an unknown solver
+bool solve(const Graph &g, HamiltonianCycle &cycle, const std::string &solver, SolverContext &ctx, int max_itr) {
+  if (solver == "greedy") {
+    greedy_constructive_heuristic(g, cycle);
+  }
+  else if (solver == "sfc") {
+    space_filling_curve(g, cycle);
+  }
+  else if (solver == "sfc_greedy") {
+    greedy_space_filling_curve(g, cycle);
+  }
+  else if (solver == "nn") {
+    randomize_nearest_neighbor(g, cycle, 0, ctx);
+    ctx.moves = dlb_2opt(g, cycle, NEIGHBORS);
+  }
+  else if (solver == "grasp") {
+    grasp(g, cycle, max_itr, ctx);
+    return true;
+  }
+  else if (solver == "ils") {
+    cycle.valid = false;
+    iterated_local_search(g, cycle, max_itr, 0, ctx);
+    return true;
+  }
+  else {
+    return false;
+  }
+  ctx.iterations = 1;
+  return true;
+}
+
+void worker(JobQueue &queue, GraphCache &cache) {
+  Job job;
+  while (queue.pop(job)) {
+    bool hit;
+    std::string error;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::shared_ptr<const Graph> g = cache.get(job, hit, error);
+    double build_time = hit ? 0 : std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (g == nullptr) {
+      write_error(job, error);
+      continue;
+    }
+
+    if (job.solver == "ils" && g->n < 8) {
+      write_error(job, "instance too small for ils");
+      continue;
+    }
+
+    HamiltonianCycle cycle;
+    cycle.resize(g->n);
+    SolverContext ctx(job.seed);
+    int max_itr = GRASP_ITR;
+    if (job.seconds > 0) {
+      ctx.set_time_limit(job.seconds);
+      max_itr = INT_MAX;
+    }
+
+    begin = std::chrono::steady_clock::now();
+    if (!solve(*g, cycle, job.solver, ctx, max_itr)) {
+      write_error(job, "unknown solver " + job.solver);
+      continue;
+    }
+    double solve_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    write_result(job, cycle, build_time, solve_time, ctx.iterations);
+  }
+}
+
+//    Readers
+void read_jobs(std::istream &in, JobQueue &queue, int &next_id) {
+  std::string line;
+  Job job;
+  while (std::getline(in, line)) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+
+    if (parse_job(line, next_id, job)) {
+      queue.push(job);
+    }
+    else {
+      write_error(job, "invalid job");
+    }
+    next_id++;
+  }
+}
+
+// Job files are taken in name order and deleted once read
+void read_spool(const std::string &spool, JobQueue &queue, int &next_id) {
+  while (true) {
+    std::vector<std::string> names;
+    bool stop = false;
+
+    DIR *dir = opendir(spool.c_str());
+    if (dir == nullptr) {
+      std::cerr << "batch: spool directory not found: " << spool << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    struct dirent *dp;
+    while ((dp = readdir(dir)) != nullptr) {
+      std::string name = dp->d_name;
+      if (name == "stop") {
+        stop = true;
+      }
+      else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".job") == 0) {
+        names.push_back(name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &name : names) {
+      std::string path = spool + "/" + name;
+      std::ifstream f(path.c_str());
+      read_jobs(f, queue, next_id);
+      f.close();
+      std::remove(path.c_str());
+    }
+
+    if (stop) {
+      std::remove((spool + "/stop").c_str());
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SPOOL_POLL_MS));
+  }
+}
+
+int main(int argc, char **argv) {
+  int n_threads = (argc > 1) ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  int cache_size = (argc > 2) ? std::atoi(argv[2]) : 8;
+  n_threads = std::max(1, n_threads);
+
+  JobQueue queue;
+  GraphCache cache(cache_size);
+  std::vector<std::thread> workers;
+  for (int t=0; t<n_threads; t++) {
+    workers.emplace_back(worker, std::ref(queue), std::ref(cache));
+  }
+
+  int next_id = 0;
+  if (argc > 3) {
+    read_spool(argv[3], queue, next_id);
+  }
+  else {
+    read_jobs(std::cin, queue, next_id);
+  }
+
+  queue.close();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+}
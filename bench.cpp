@@ -0,0 +1,224 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <algorithm>
+#include "Graph.h"
+#include "Solver.h"
+#include "Stats.h"
+
+// Benchmark of the solvers over the EUC_2D instances, with the % gap to the published
+// TSPLIB optima. One record per (instance, solver, repetition), repetition r runs with
+// seed r. Records go to stdout as CSV (default) or JSON, and the hot path counters of
+// each run to stderr when built with TSP_STATS. The *_lk solvers use Lin-Kernighan as
+// local search, with the lk_depth= and lk_breadth= options, and write the flips tried
+// and closed at each depth to stderr.
+//
+// usage: ./bench [reps] [csv|json] [solver ...] [lk_depth=N] [lk_breadth=N]
+//        solvers: greedy sfc sfc_greedy grasp grasp_lk ils ils_lk vnd tabu tabu_lk
+
+const int NEIGHBORS = 20;
+const int GRASP_ITR = 1000;
+const int TABU_ITR = 200;
+const int ILS_ITR = 1000;
+
+const std::map<std::string, int> OPTIMA = {
+  {"att48", 10628}, {"berlin52", 7542}, {"kroA100", 21282}, {"kroA150", 26524},
+  {"kroA200", 29368}, {"kroB100", 22141}, {"kroB150", 26130}, {"kroB200", 29437},
+  {"kroC100", 20749}, {"kroD100", 21294}, {"kroE100", 22068}, {"lin105", 14379},
+  {"pr107", 44303}, {"pr124", 59030}, {"pr136", 96772}, {"pr144", 58537},
+  {"pr152", 73682}, {"pr76", 108159}, {"rat195", 2323}, {"rat99", 1211}, {"st70", 675}
+};
+
+struct Record {
+  std::string instance;
+  int n;
+  std::string solver;
+  int rep;
+  double length;
+  int optimum;       // 0 when unknown
+  double seconds;
+  long long iterations;
+  long long moves;
+};
+
+// Length of the tour recomputed from the graph, not the incremental one of the solver
+double tour_length(const Graph &g) {
+  double len = 0;
+  for (int i=0; i<g.n; i++) {
+    len += g.dist(g.cycle.tour[i], g.cycle.tour[(i+1) % g.n]);
+  }
+  return len;
+}
+
+void run_solver(Graph &g, const std::string &solver, SolverContext &ctx) {
+  if (solver == "greedy") {
+    greedy_constructive_heuristic(g);
+    ctx.iterations = 1;
+  }
+  else if (solver == "sfc") {
+    space_filling_curve(g);
+    ctx.iterations = 1;
+  }
+  else if (solver == "sfc_greedy") {
+    greedy_space_filling_curve(g);
+    ctx.iterations = 1;
+  }
+  else if (solver == "grasp" || solver == "grasp_lk") {
+    grasp(g, GRASP_ITR, ctx, solver == "grasp" ? TWO_OPT : LIN_KERNIGHAN);
+  }
+  else if (solver == "ils" || solver == "ils_lk") {
+    iterated_local_search(g, ILS_ITR, 0, ctx, solver == "ils" ? TWO_OPT : LIN_KERNIGHAN);
+  }
+  else if (solver == "vnd") {
+    randomize_nearest_neighbor(g, 0.1, ctx);
+    ctx.moves = local_search_vnd(g, NEIGHBORS);
+    ctx.iterations = 1;
+  }
+  else if (solver == "tabu" || solver == "tabu_lk") {
+    randomize_nearest_neighbor(g, 0.1, ctx);
+    tabu_search(g, NEIGHBORS, TABU_ITR, ctx, solver == "tabu" ? TWO_OPT : LIN_KERNIGHAN);
+  }
+  else {
+    std::cout << "Unknown solver: " << solver << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+// One line per run: the settings, then the counts of depths 1 to lk_depth
+void write_lk_stats(const std::string &name, const SolverContext &ctx, const LKStats &stats) {
+  std::cerr << "lk " << name << " depth=" << ctx.lk_depth << " breadth=" << ctx.lk_breadth << " tried=";
+  for (size_t d=1; d<stats.tried.size(); d++) {
+    std::cerr << (d > 1 ? "," : "") << stats.tried[d];
+  }
+  std::cerr << " closed=";
+  for (size_t d=1; d<stats.closed.size(); d++) {
+    std::cerr << (d > 1 ? "," : "") << stats.closed[d];
+  }
+  std::cerr << std::endl;
+}
+
+double per_second(long long count, double seconds) {
+  return seconds > 0 ? count / seconds : 0;
+}
+
+void write_csv(const std::vector<Record> &records) {
+  std::cout << "instance,n,solver,rep,length,optimum,gap,seconds,iterations,iter_per_s,moves,moves_per_s" << std::endl;
+  for (const Record &r : records) {
+    std::cout << r.instance << "," << r.n << "," << r.solver << "," << r.rep << ","
+              << r.length << ",";
+    if (r.optimum > 0) {
+      std::cout << r.optimum << "," << 100.0 * (r.length - r.optimum) / r.optimum;
+    }
+    else {
+      std::cout << ",";
+    }
+    std::cout << "," << r.seconds << "," << r.iterations << "," << per_second(r.iterations, r.seconds)
+              << "," << r.moves << "," << per_second(r.moves, r.seconds) << std::endl;
+  }
+}
+
+void write_json(const std::vector<Record> &records) {
+  std::cout << "[" << std::endl;
+  for (size_t i=0; i<records.size(); i++) {
+    const Record &r = records[i];
+    std::cout << "  {\"instance\": \"" << r.instance << "\", \"n\": " << r.n
+              << ", \"solver\": \"" << r.solver << "\", \"rep\": " << r.rep
+              << ", \"length\": " << r.length;
+    if (r.optimum > 0) {
+      std::cout << ", \"optimum\": " << r.optimum << ", \"gap\": " << 100.0 * (r.length - r.optimum) / r.optimum;
+    }
+    else {
+      std::cout << ", \"optimum\": null, \"gap\": null";
+    }
+    std::cout << ", \"seconds\": " << r.seconds
+              << ", \"iterations\": " << r.iterations << ", \"iter_per_s\": " << per_second(r.iterations, r.seconds)
+              << ", \"moves\": " << r.moves << ", \"moves_per_s\": " << per_second(r.moves, r.seconds) << "}"
+              << (i+1 < records.size() ? "," : "") << std::endl;
+  }
+  std::cout << "]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  int reps = (argc > 1) ? std::atoi(argv[1]) : 3;
+  bool json = (argc > 2) && std::strcmp(argv[2], "json") == 0;
+  int lk_depth = SolverContext().lk_depth;
+  int lk_breadth = SolverContext().lk_breadth;
+  std::vector<std::string> solvers;
+  for (int i=3; i<argc; i++) {
+    if (std::strncmp(argv[i], "lk_depth=", 9) == 0) {
+      lk_depth = std::atoi(argv[i] + 9);
+    }
+    else if (std::strncmp(argv[i], "lk_breadth=", 11) == 0) {
+      lk_breadth = std::atoi(argv[i] + 11);
+    }
+    else {
+      solvers.push_back(argv[i]);
+    }
+  }
+  if (lk_depth < 1 || lk_breadth < 1) {
+    std::cout << "bench: lk_depth and lk_breadth must be positive" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (solvers.empty()) {
+    solvers = {"greedy", "grasp", "vnd", "tabu"};
+  }
+
+  std::vector<std::string> input_names;
+  DIR *dir = opendir("EUC_2D");
+  if (dir == nullptr) {
+    std::cout << "bench: EUC_2D directory not found" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  struct dirent *dp;
+  while ((dp = readdir(dir)) != nullptr) {
+    if (dp->d_name[0] != '.') {
+      input_names.push_back(dp->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(input_names.begin(), input_names.end());
+
+  std::vector<Record> records;
+  Graph graph;
+  for (std::string name : input_names) {
+    graph.build(("EUC_2D/" + name).c_str(), "auto", NEIGHBORS);
+    std::string instance = name.substr(0, name.find('.'));
+    std::map<std::string, int>::const_iterator opt = OPTIMA.find(instance);
+
+    for (const std::string &solver : solvers) {
+      for (int rep=0; rep<reps; rep++) {
+        SolverContext ctx(rep);
+        LKStats lk_stats;
+        bool lk = solver.size() > 3 && solver.compare(solver.size() - 3, 3, "_lk") == 0;
+        ctx.lk_depth = lk_depth;
+        ctx.lk_breadth = lk_breadth;
+        ctx.lk_stats = lk ? &lk_stats : nullptr;
+        graph.cycle.valid = false;
+
+        STATS_RESET();
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        run_solver(graph, solver, ctx);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        STATS_DUMP((instance + " " + solver).c_str());
+        if (lk) {
+          write_lk_stats(instance + " " + solver, ctx, lk_stats);
+        }
+
+        records.push_back({instance, graph.n, solver, rep, tour_length(graph),
+                           opt != OPTIMA.end() ? opt->second : 0, seconds, ctx.iterations, ctx.moves});
+      }
+    }
+  }
+
+  if (json) {
+    write_json(records);
+  }
+  else {
+    write_csv(records);
+  }
+}
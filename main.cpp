@@ -1,12 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <ctime>
+#include <chrono>
 #include <iomanip>
 #include <dirent.h>
 #include <algorithm>
 #include "Graph.h"
 #include "Solver.h"
+#include "Stats.h"
 
 int main() {
   std::vector<std::string> input_names;
@@ -22,14 +23,14 @@ int main() {
   std::sort(input_names.begin(), input_names.end());
 
   double build_time, elapsed_time;
-  std::string metric;
   std::ofstream f;
-  std::clock_t begin;
+  std::chrono::steady_clock::time_point begin;
   Graph graph;
 
 
   // graph.build("EUC_2D/att48.tsp");
-  // randomize_nearest_neighbor(graph, 0.5);
+  // SolverContext ctx(0);
+  // randomize_nearest_neighbor(graph, 0.5, ctx);
   // std::cout << "obj func: " << graph.cycle.len << std::endl;
   // for (int i=0; i<graph.n; i++) {
   //   std::cout << graph.cycle.tour[i] << " ";
@@ -37,25 +38,21 @@ int main() {
   // std::cout << std::endl;
 
   for (std::string name : input_names) {
-    if (name == "att48.tsp") {
-      metric = "pseudo_euclid";
-    }
-    else {
-      metric = "euclid";
-    }
-
     std::cout << "\n==========> SOLVING " + name << std::endl;
 
-    begin = clock();
-    graph.build(("EUC_2D/" + name).c_str(), metric.c_str(), true);
-    build_time = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+    begin = std::chrono::steady_clock::now();
+    graph.build(("EUC_2D/" + name).c_str(), "auto", 20);
+    build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
     std::cout << "Building time: " << build_time << std::endl;
 
     f.open(("OUT/" + name).c_str());
 
-    begin = clock();
-    grasp(graph, 5000);
-    elapsed_time = static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+    SolverContext ctx(0);
+    STATS_RESET();
+    begin = std::chrono::steady_clock::now();
+    grasp(graph, 5000, ctx);
+    elapsed_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    STATS_DUMP("grasp");
     std::cout << "-> Constructive Heuristic" << std::endl;
     std::cout << "elapsed time = " << elapsed_time << "s (" << elapsed_time + build_time << ")";
     std::cout << " - Objective Function = " << graph.cycle.len << std::endl;
@@ -67,9 +64,9 @@ int main() {
     f << std::endl;
     f << std::endl;
 
-    // begin = clock();
-    // tabu_search(graph, 20, 200);
-    // elapsed_time += static_cast<double>(clock() - begin) / CLOCKS_PER_SEC;
+    // begin = std::chrono::steady_clock::now();
+    // tabu_search(graph, 20, 200, ctx);
+    // elapsed_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
     // std::cout << "-> Tabu Search [2opt (k=20)]" << std::endl;
     // std::cout << "elapsed time = " << elapsed_time << "s (" << elapsed_time + build_time << ")";
     // std::cout << " - Objective Function = " << graph.cycle.len << std::endl;
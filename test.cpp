@@ -0,0 +1,150 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <dirent.h>
+#include <algorithm>
+#include "Graph.h"
+#include "Solver.h"
+
+// Regression checks, run by make test. Each test prints a line per failure and returns
+// the number of failures, the program exits with EXIT_FAILURE when any test failed.
+//
+// usage: ./tests
+
+const char *CACHE_FILE = "/tmp/tsp_test.cache";
+const int TABU_ITR = 30;
+
+// Same distances and candidate lists
+int compare_graphs(const Graph &g, const Graph &h, const std::string &name) {
+  if (g.n != h.n) {
+    std::cout << "FAIL " << name << ": n " << g.n << " != " << h.n << std::endl;
+    return 1;
+  }
+  for (int i=0; i<g.n; i++) {
+    for (int j=0; j<g.n; j++) {
+      if (g.dist(i, j) != h.dist(i, j)) {
+        std::cout << "FAIL " << name << ": d(" << i << "," << j << ") " << h.dist(i, j)
+                  << " != " << g.dist(i, j) << std::endl;
+        return 1;
+      }
+    }
+  }
+  if (g.sorted_neighbor.width() != h.sorted_neighbor.width()) {
+    std::cout << "FAIL " << name << ": neighbor width " << h.sorted_neighbor.width()
+              << " != " << g.sorted_neighbor.width() << std::endl;
+    return 1;
+  }
+  for (int i=0; i<g.n; i++) {
+    for (int j=0; j<g.sorted_neighbor.width(); j++) {
+      if (g.sorted_neighbor[i][j] != h.sorted_neighbor[i][j]) {
+        std::cout << "FAIL " << name << ": neighbor row " << i << std::endl;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+//    Binary cache
+// A cache is only reused for the metric it was requested with: one written under a
+// forced metric must not be picked up by "auto", and the other way around.
+int test_cache() {
+  const char *f_name = "EUC_2D/att48.tsp";   // ATT, "auto" is pseudo_euclid
+  const int k = 10;
+  int failures = 0;
+
+  Graph automatic, euclid, sparse;
+  automatic.build(f_name, "auto", k);
+  euclid.build(f_name, "euclid", k);
+  sparse.build_sparse(f_name, k);
+
+  const char *metrics[] = {"euclid", "auto", "auto", "euclid", "euclid"};
+  std::remove(CACHE_FILE);
+  for (const char *metric : metrics) {
+    Graph cached;
+    cached.build_cached(f_name, CACHE_FILE, k, false, metric);
+    failures += compare_graphs(std::string(metric) == "auto" ? automatic : euclid, cached,
+                               std::string("cache ") + metric);
+  }
+
+  std::remove(CACHE_FILE);
+  for (int i=0; i<2; i++) {
+    Graph cached;
+    cached.build_cached(f_name, CACHE_FILE, k, true);
+    failures += compare_graphs(sparse, cached, "cache sparse");
+  }
+  std::remove(CACHE_FILE);
+  return failures;
+}
+
+//    2-opt kernels
+// best_2opt walks a tabu search from a nearest neighbor tour, so the tabu list fills up
+// from the first iteration. Before every step the scalar and AVX2 kernels must return
+// the move of the plain scan.
+int compare_moves(const Move &expected, const Move &move, const std::string &name) {
+  if (move.a != expected.a || move.b != expected.b || move.c != expected.c || move.d != expected.d
+      || move.gain != expected.gain) {
+    std::cout << "FAIL " << name << ": move (" << move.a << " " << move.b << " " << move.c << " "
+              << move.d << ") gain " << move.gain << ", scan (" << expected.a << " " << expected.b
+              << " " << expected.c << " " << expected.d << ") gain " << expected.gain << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int test_2opt_kernels() {
+  std::vector<std::string> files;
+  DIR *dir = opendir("EUC_2D");
+  if (dir == nullptr) {
+    std::cout << "FAIL 2opt kernels: EUC_2D directory not found" << std::endl;
+    return 1;
+  }
+  struct dirent *dp;
+  while ((dp = readdir(dir)) != nullptr) {
+    std::string name = dp->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tsp") == 0) {
+      files.push_back("EUC_2D/" + name);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+
+  bool avx2 = two_opt_kernel_supported(KERNEL_AVX2);
+  if (!avx2) {
+    std::cout << "2opt kernels: no AVX2 on this CPU, only the scalar kernel is checked" << std::endl;
+  }
+
+  int failures = 0;
+  for (const std::string &f_name : files) {
+    Graph g;
+    g.build(f_name.c_str(), "auto", 10);
+    SolverContext ctx(0);
+    randomize_nearest_neighbor(g, 0, ctx);
+
+    TabuList tl(g.n);
+    tl.tabu_time = 14;
+    for (int itr=0; itr<TABU_ITR; itr++) {
+      Move scan = best_2opt_scan(g, g.cycle, tl);
+      failures += compare_moves(scan, best_2opt_move(g, g.cycle, tl, KERNEL_SCALAR), f_name + " scalar");
+      if (avx2) {
+        failures += compare_moves(scan, best_2opt_move(g, g.cycle, tl, KERNEL_AVX2), f_name + " avx2");
+      }
+      best_2opt(g, tl);
+    }
+  }
+  return failures;
+}
+
+int main() {
+  int failures = 0;
+  failures += test_cache();
+  failures += test_2opt_kernels();
+
+  if (failures > 0) {
+    std::cout << failures << " failure(s)" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "All tests passed" << std::endl;
+}